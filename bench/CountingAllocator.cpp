@@ -0,0 +1,104 @@
+#include "CountingAllocator.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<std::size_t> allocations(0);
+static std::atomic<std::size_t> allocated_bytes(0);
+
+// Each block starts with its size, for the unsized deletes to take off the
+// bytes held; the header is as long as malloc's alignment so that what
+// follows it stays aligned.
+static const std::size_t kHeaderLength = alignof(std::max_align_t);
+
+static void *CountedAllocate(std::size_t size) noexcept
+{
+	void *block = malloc(kHeaderLength + size);
+	if (block == nullptr)
+	{
+		return nullptr;
+	}
+
+	allocations++;
+	allocated_bytes += size;
+	*(std::size_t *)block = size;
+	return (char *)block + kHeaderLength;
+}
+
+static void CountedFree(void *p) noexcept
+{
+	if (p == nullptr)
+	{
+		return;
+	}
+
+	void *block = (char *)p - kHeaderLength;
+	allocated_bytes -= *(std::size_t *)block;
+	free(block);
+}
+
+std::size_t AllocationCount()
+{
+	return allocations;
+}
+
+std::size_t AllocatedBytes()
+{
+	return allocated_bytes;
+}
+
+void *operator new(std::size_t size)
+{
+	void *p = CountedAllocate(size);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void *operator new[](std::size_t size, std::nothrow_t const &) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete(void *p, std::nothrow_t const &) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete[](void *p, std::nothrow_t const &) noexcept
+{
+	CountedFree(p);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+
+// CountingAllocator.cpp replaces the global operator new and delete, in every
+// form, for the benches that link it, counting what they allocate.
+
+// Allocations made so far.
+std::size_t AllocationCount();
+
+// Bytes asked for by allocations not yet freed.
+std::size_t AllocatedBytes();
@@ -0,0 +1,132 @@
+// Converts files with OpenCC and with ConversionEngine, checks that the two
+// agree byte for byte and reports the throughput of each and the heap
+// allocations each makes per megabyte converted.
+// usage: convert_bench <profile> <file>...
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <opencc/Config.hpp>
+#include <opencc/Converter.hpp>
+#include <opencc/Exception.hpp>
+#include "CountingAllocator.hpp"
+#include "../src/ConversionEngine.hpp"
+
+static double PerMegabyte(std::size_t count, std::size_t bytes)
+{
+	return bytes > 0 ? (double)count / bytes * (1 << 20) : 0;
+}
+
+static double MegabytesPerSecond(std::size_t bytes, std::chrono::steady_clock::duration elapsed)
+{
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	return seconds > 0 ? bytes / seconds / (1 << 20) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: " << argv[0] << " <profile> <file>..." << std::endl;
+		return 2;
+	}
+
+	try
+	{
+		opencc::Config config;
+		opencc::ConverterPtr converter = config.NewFromFile(argv[1]);
+		ConversionEngine engine;
+		if (!engine.Load(*converter))
+		{
+			std::cerr << "the engine does not support " << argv[1] << std::endl;
+			return 2;
+		}
+
+		int ret = 0;
+		std::size_t total = 0;
+		int rejected = 0;
+		std::chrono::steady_clock::duration opencc_time(0);
+		std::chrono::steady_clock::duration engine_time(0);
+		std::size_t opencc_allocations = 0;
+		std::size_t engine_allocations = 0;
+		for (int i = 2; i < argc; i++)
+		{
+			std::ifstream ifs(argv[i], std::ios::binary);
+			std::stringstream buffer;
+			buffer << ifs.rdbuf();
+			std::string text = buffer.str();
+
+			// Text OpenCC rejects, such as another charset, has to be rejected
+			// by the engine too; it doesn't count towards the throughput.
+			std::string expected;
+			std::string actual;
+			std::size_t start_allocations = AllocationCount();
+			auto start = std::chrono::steady_clock::now();
+			bool expected_error = false;
+			try
+			{
+				expected = converter->Convert(text);
+			}
+			catch (opencc::Exception const &)
+			{
+				expected_error = true;
+			}
+
+			auto middle = std::chrono::steady_clock::now();
+			std::size_t middle_allocations = AllocationCount();
+			bool actual_error = false;
+			try
+			{
+				engine.Convert(text.data(), text.length(), actual);
+			}
+			catch (opencc::Exception const &)
+			{
+				actual_error = true;
+			}
+
+			auto end = std::chrono::steady_clock::now();
+			std::size_t end_allocations = AllocationCount();
+			if (expected_error || actual_error)
+			{
+				if (expected_error != actual_error)
+				{
+					std::cout << argv[i] << ": rejected by " << (expected_error ? "opencc" : "the engine") << " only" << std::endl;
+					ret = 1;
+				}
+
+				rejected++;
+				continue;
+			}
+
+			opencc_time += middle - start;
+			engine_time += end - middle;
+			opencc_allocations += middle_allocations - start_allocations;
+			engine_allocations += end_allocations - middle_allocations;
+			total += text.length();
+
+			if (actual != expected)
+			{
+				std::size_t at = 0;
+				while (at < actual.length() && at < expected.length() && actual[at] == expected[at])
+				{
+					at++;
+				}
+
+				std::cout << argv[i] << ": differs at byte " << at << std::endl;
+				ret = 1;
+			}
+		}
+
+		std::cout << total << " bytes in " << argc - 2 - rejected << " files, " << rejected << " rejected by both" << std::endl;
+		std::cout << "opencc: " << MegabytesPerSecond(total, opencc_time) << " MB/s, " << PerMegabyte(opencc_allocations, total) << " allocations per MB" << std::endl;
+		std::cout << "engine: " << MegabytesPerSecond(total, engine_time) << " MB/s, " << PerMegabyte(engine_allocations, total) << " allocations per MB" << std::endl;
+		std::cout << (ret == 0 ? "identical" : "DIFFERENT") << std::endl;
+		return ret;
+	}
+	catch (opencc::Exception const &oe)
+	{
+		std::cerr << "OpenCC Error: " << oe.what() << std::endl;
+		return 2;
+	}
+}
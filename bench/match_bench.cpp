@@ -0,0 +1,158 @@
+// Looks up the longest key at every character of the given files in one
+// dictionary, through OpenCC's MarisaDict and through PrefixDict, checks the
+// two agree and reports the lookups per second and heap allocations per
+// lookup of each, and the heap each takes to hold the entries: a Lexicon of
+// DictEntry objects against PrefixDict's pools. Each lookup takes the
+// matched key's length and default value, as a conversion does.
+// usage: match_bench <dict.ocd2> <file>...
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencc/DictEntry.hpp>
+#include <opencc/Exception.hpp>
+#include <opencc/MarisaDict.hpp>
+#include "CountingAllocator.hpp"
+#include "../src/PrefixDict.hpp"
+#include "../src/Utf8.hpp"
+
+static double PerSecond(std::size_t count, std::chrono::steady_clock::duration elapsed)
+{
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	return seconds > 0 ? count / seconds : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: " << argv[0] << " <dict.ocd2> <file>..." << std::endl;
+		return 2;
+	}
+
+	try
+	{
+		opencc::MarisaDictPtr marisa_dict = opencc::SerializableDict::NewFromFile<opencc::MarisaDict>(argv[1]);
+		opencc::LexiconPtr lexicon = marisa_dict->GetLexicon();
+
+		// What a copy of the dictionary's Lexicon holds on the heap, as
+		// OpenCC keeps it, against what a PrefixDict holds.
+		std::size_t before = AllocatedBytes();
+		std::unique_ptr<opencc::Lexicon> lexicon_copy(new opencc::Lexicon());
+		for (auto const &entry : *lexicon)
+		{
+			lexicon_copy->Add(opencc::DictEntryFactory::New(entry.get()));
+		}
+
+		std::size_t lexicon_bytes = AllocatedBytes() - before;
+		lexicon_copy.reset();
+		before = AllocatedBytes();
+		std::unique_ptr<PrefixDict> dict_holder(new PrefixDict(*lexicon));
+		std::size_t dict_bytes = AllocatedBytes() - before;
+		PrefixDict const &dict = *dict_holder;
+
+		std::string text;
+		for (int i = 2; i < argc; i++)
+		{
+			std::ifstream ifs(argv[i], std::ios::binary);
+			std::stringstream buffer;
+			buffer << ifs.rdbuf();
+			text += buffer.str();
+		}
+
+		// Lookups start at every character, as segmentation's do.
+		std::vector<std::size_t> starts;
+		const unsigned char *begin = (const unsigned char *)text.data();
+		const unsigned char *end = begin + text.length();
+		for (const unsigned char *p = begin; p < end;)
+		{
+			starts.push_back(p - begin);
+			unsigned cp;
+			p += ReadUtf8(p, end - p, cp);
+		}
+
+		// Repeated so that small inputs still take measurable time.
+		const int rounds = 5;
+		std::size_t opencc_matched = 0;
+		std::size_t opencc_values = 0;
+		std::size_t start_allocations = AllocationCount();
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; round++)
+		{
+			for (std::size_t pos : starts)
+			{
+				opencc::Optional<const opencc::DictEntry *> entry = marisa_dict->MatchPrefix(text.data() + pos, text.length() - pos);
+				if (!entry.IsNull())
+				{
+					opencc_matched += entry.Get()->KeyLength();
+					opencc_values += entry.Get()->GetDefault().length();
+				}
+			}
+		}
+
+		auto middle = std::chrono::steady_clock::now();
+		std::size_t middle_allocations = AllocationCount();
+		std::size_t matched = 0;
+		std::size_t values = 0;
+		for (int round = 0; round < rounds; round++)
+		{
+			for (std::size_t pos : starts)
+			{
+				EntryView entry;
+				if (dict.MatchPrefix(text.data() + pos, text.length() - pos, entry) > 0)
+				{
+					matched += entry.key_length;
+					values += entry.value_length;
+				}
+			}
+		}
+
+		auto finish = std::chrono::steady_clock::now();
+		std::size_t finish_allocations = AllocationCount();
+
+		// Every value of every entry, not only the defaults. The lexicon is
+		// in the dictionary file's order.
+		std::map<std::string, std::size_t> index;
+		for (std::size_t i = 0; i < dict.Size(); i++)
+		{
+			index[dict.Key(i)] = i;
+		}
+
+		bool same_values = dict.Size() == lexicon->Length();
+		for (std::size_t i = 0; i < lexicon->Length() && same_values; i++)
+		{
+			std::vector<std::string> expected = lexicon->At(i)->Values();
+			if (expected.empty())
+			{
+				expected.push_back(lexicon->At(i)->GetDefault());
+			}
+
+			auto found = index.find(lexicon->At(i)->Key());
+			same_values = found != index.end() && dict.Entry(found->second).value_count == expected.size();
+			for (std::size_t k = 0; same_values && k < expected.size(); k++)
+			{
+				EntryView value = dict.Entry(found->second, k);
+				same_values = std::string(value.value, value.value_length) == expected[k];
+			}
+		}
+
+		std::size_t lookups = starts.size() * rounds;
+		std::cout << lookups << " lookups in " << dict.Size() << " keys" << std::endl;
+		std::cout << "lexicon: " << lexicon_bytes << " bytes on the heap" << std::endl;
+		std::cout << "prefix dict: " << dict_bytes << " bytes on the heap, " << dict.MemoryUsage() << " held" << std::endl;
+		std::cout << "opencc: " << PerSecond(lookups, middle - start) << " lookups/s, " << (double)(middle_allocations - start_allocations) / lookups << " allocations per lookup" << std::endl;
+		std::cout << "prefix dict: " << PerSecond(lookups, finish - middle) << " lookups/s, " << (double)(finish_allocations - middle_allocations) / lookups << " allocations per lookup" << std::endl;
+		bool same = matched == opencc_matched && values == opencc_values && same_values;
+		std::cout << (same ? "identical" : "DIFFERENT") << std::endl;
+		return same ? 0 : 1;
+	}
+	catch (opencc::Exception const &oe)
+	{
+		std::cerr << "OpenCC Error: " << oe.what() << std::endl;
+		return 2;
+	}
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Runs cc over a tree of many small files once per value of a config key,
+# e.g. io_backend posix io_uring, or durability none syncfs fsync. For
+# durability, run it on the filesystem in question: on tmpfs every mode
+# costs the same.
+# usage: bench/sweep.sh <cc binary> <profile directory> <work directory> <key> <value>...
+# FILES sets the number of files in the tree, 20000 by default.
+set -e
+
+if [ $# -lt 5 ]; then
+	echo "usage: $0 <cc binary> <profile directory> <work directory> <key> <value>..." >&2
+	exit 2
+fi
+
+cc=$(realpath "$1")
+profiles=$(realpath "$2")
+work=$3
+key=$4
+shift 4
+files=${FILES:-20000}
+
+mkdir -p "$work"
+cd "$work"
+cp "$profiles"/*.json "$profiles"/*.ocd2 .
+
+if [ ! -d input ]; then
+	i=0
+	while [ $i -lt $files ]; do
+		dir=input/d$((i / 500))
+		mkdir -p "$dir"
+		printf '简体中文 %d 汉字转换测试\n' $i > "$dir/f$i.txt"
+		i=$((i + 1))
+	done
+fi
+
+for value in "$@"; do
+	cat > config.yaml <<EOF
+cc:
+    input_directory: 'input'
+    output_directory: 'output'
+    $key: '$value'
+EOF
+	rm -rf output
+	sync
+	echo "== $key $value"
+	"$cc" | grep -E '^(io backend|converted|elapsed)'
+done
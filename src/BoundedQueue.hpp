@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// FIFO handing items from producer threads to consumers. Push blocks while
+// the queue is full, so a fast producer can't run ahead of the consumers
+// without bound.
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(std::size_t capacity) : capacity_(capacity), closed_(false)
+	{
+	}
+
+	BoundedQueue(BoundedQueue const &) = delete;
+	BoundedQueue &operator=(BoundedQueue const &) = delete;
+
+	// Returns false, dropping the item, once the queue is closed.
+	bool Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+		if (closed_)
+		{
+			return false;
+		}
+
+		items_.push_back(std::move(item));
+		lock.unlock();
+		not_empty_.notify_one();
+		return true;
+	}
+
+	// Blocks for the next item. Returns false once the queue is closed and
+	// drained.
+	bool Pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty())
+		{
+			return false;
+		}
+
+		item = std::move(items_.front());
+		items_.pop_front();
+		lock.unlock();
+		not_full_.notify_one();
+		return true;
+	}
+
+	// Wakes every waiter. Items already queued can still be popped.
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+
+		not_full_.notify_all();
+		not_empty_.notify_all();
+	}
+
+private:
+	std::size_t capacity_;
+	std::deque<T> items_;
+	std::mutex mutex_;
+	std::condition_variable not_full_;
+	std::condition_variable not_empty_;
+	bool closed_;
+};
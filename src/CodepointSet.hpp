@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Two-level bitmap over all Unicode codepoints. Blocks of 256 codepoints with
+// no member share one empty leaf, so a set of CJK characters costs a few KB
+// instead of the 136 KB of a flat bitmap.
+class CodepointSet
+{
+public:
+	CodepointSet() : index_(kBlockCount, 0), leaves_(kLeafWords, 0), ascii_(false)
+	{
+	}
+
+	void Insert(std::uint32_t cp)
+	{
+		if (cp >= kCodepointLimit)
+		{
+			return;
+		}
+
+		std::uint16_t &leaf = index_[cp >> 8];
+		if (leaf == 0)
+		{
+			leaf = (std::uint16_t)(leaves_.size() / kLeafWords);
+			leaves_.resize(leaves_.size() + kLeafWords, 0);
+		}
+
+		leaves_[leaf * kLeafWords + ((cp & 0xFF) >> 6)] |= (std::uint64_t)1 << (cp & 63);
+		ascii_ = ascii_ || cp < 0x80;
+	}
+
+	bool Contains(std::uint32_t cp) const
+	{
+		if (cp >= kCodepointLimit)
+		{
+			return false;
+		}
+
+		return (leaves_[index_[cp >> 8] * kLeafWords + ((cp & 0xFF) >> 6)] >> (cp & 63)) & 1;
+	}
+
+	// True if any member is below U+0080, so scans can't skip ASCII runs.
+	bool HasAscii() const
+	{
+		return ascii_;
+	}
+
+	bool Empty() const
+	{
+		return leaves_.size() == kLeafWords;
+	}
+
+	std::size_t MemoryUsage() const
+	{
+		return index_.size() * sizeof(std::uint16_t) + leaves_.size() * sizeof(std::uint64_t);
+	}
+
+private:
+	static const std::uint32_t kCodepointLimit = 0x110000;
+	static const std::size_t kBlockCount = kCodepointLimit >> 8;
+	static const std::size_t kLeafWords = 256 / 64;
+
+	std::vector<std::uint16_t> index_;
+	// Leaf 0 is the shared empty leaf.
+	std::vector<std::uint64_t> leaves_;
+	bool ascii_;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Maps codepoints to small integers. The CJK Unified Ideographs blocks
+// (extension A and the main block), where nearly all keys of a character
+// dictionary lie, are a flat array indexed by the codepoint; anything else,
+// the supplementary planes included, is found in a sorted array. A table
+// of few codepoints can leave out the flat array and keep all of them
+// sorted.
+class CodepointTable
+{
+public:
+	static const std::uint32_t kNone = 0xFFFFFFFF;
+
+	explicit CodepointTable(bool dense = true) : dense_(dense ? kDenseLast - kDenseFirst + 1 : 0, (std::uint32_t)kNone)
+	{
+	}
+
+	// Whether a table of these codepoints is better off with the flat
+	// array: no more than eight times the size of a sorted one for those in
+	// the CJK blocks.
+	static bool DenseFor(std::vector<std::uint32_t> const &cps)
+	{
+		std::size_t count = std::count_if(cps.begin(), cps.end(), [](std::uint32_t cp) {
+			return cp >= kDenseFirst && cp <= kDenseLast;
+		});
+		return (kDenseLast - kDenseFirst + 1) * sizeof(std::uint32_t) <= 8 * count * sizeof(std::pair<std::uint32_t, std::uint32_t>);
+	}
+
+	// A codepoint already present keeps its value.
+	void Insert(std::uint32_t cp, std::uint32_t value)
+	{
+		if (cp - kDenseFirst < dense_.size())
+		{
+			std::uint32_t &slot = dense_[cp - kDenseFirst];
+			slot = slot == kNone ? value : slot;
+			return;
+		}
+
+		auto it = std::lower_bound(sparse_.begin(), sparse_.end(), cp, [](std::pair<std::uint32_t, std::uint32_t> const &item, std::uint32_t key) {
+			return item.first < key;
+		});
+		if (it == sparse_.end() || it->first != cp)
+		{
+			sparse_.insert(it, std::make_pair(cp, value));
+		}
+	}
+
+	// kNone if the codepoint isn't in the table.
+	std::uint32_t Find(std::uint32_t cp) const
+	{
+		if (cp - kDenseFirst < dense_.size())
+		{
+			return dense_[cp - kDenseFirst];
+		}
+
+		auto it = std::lower_bound(sparse_.begin(), sparse_.end(), cp, [](std::pair<std::uint32_t, std::uint32_t> const &item, std::uint32_t key) {
+			return item.first < key;
+		});
+		return it != sparse_.end() && it->first == cp ? it->second : (std::uint32_t)kNone;
+	}
+
+	std::size_t MemoryUsage() const
+	{
+		return dense_.size() * sizeof(std::uint32_t) + sparse_.size() * sizeof(sparse_[0]);
+	}
+
+private:
+	static const std::uint32_t kDenseFirst = 0x3400;
+	static const std::uint32_t kDenseLast = 0x9FFF;
+
+	std::vector<std::uint32_t> dense_;
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> sparse_;
+};
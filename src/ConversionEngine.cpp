@@ -0,0 +1,611 @@
+#include "ConversionEngine.hpp"
+#include <algorithm>
+#include <cstring>
+#include <opencc/Conversion.hpp>
+#include <opencc/ConversionChain.hpp>
+#include <opencc/DictGroup.hpp>
+#include <opencc/Exception.hpp>
+#include <opencc/MaxMatchSegmentation.hpp>
+#include "Utf8.hpp"
+
+namespace
+{
+struct StringOutput
+{
+	std::string &text;
+
+	void Append(const char *data, std::size_t length)
+	{
+		text.append(data, length);
+	}
+};
+
+struct BufferOutput
+{
+	char *data;
+	std::size_t capacity;
+	std::size_t length;
+
+	void Append(const char *from, std::size_t from_length)
+	{
+		if (length + from_length <= capacity)
+		{
+			memcpy(data + length, from, from_length);
+		}
+
+		length += from_length;
+	}
+};
+
+// The text between the conversions of a chain, one buffer per level but
+// the last. The buffers are kept per thread and reused from one call to the
+// next, so once they have grown to the runs being converted a conversion
+// allocates nothing. Any grown past kKept are let go at the end of the call,
+// so that one long run doesn't hold on to its size.
+class ScratchBuffers
+{
+public:
+	explicit ScratchBuffers(std::size_t levels) : buffers(ThreadBuffers())
+	{
+		if (buffers.size() < levels)
+		{
+			buffers.resize(levels);
+		}
+	}
+
+	~ScratchBuffers()
+	{
+		for (std::string &buffer : buffers)
+		{
+			if (buffer.capacity() > kKept)
+			{
+				std::string().swap(buffer);
+			}
+		}
+	}
+
+	ScratchBuffers(ScratchBuffers const &) = delete;
+	ScratchBuffers &operator=(ScratchBuffers const &) = delete;
+
+	std::vector<std::string> &buffers;
+
+private:
+	static const std::size_t kKept = 1 << 20;
+
+	static std::vector<std::string> &ThreadBuffers()
+	{
+		thread_local std::vector<std::string> buffers;
+		return buffers;
+	}
+};
+
+// OpenCC's UTF8Util::NextCharLength, which goes by the lead byte alone and
+// allows the old five and six byte forms. left is never 0.
+std::size_t NextCharLength(const char *text, std::size_t left)
+{
+	unsigned char c = (unsigned char)*text;
+	std::size_t length;
+	if ((c & 0xF0) == 0xE0)
+	{
+		length = 3;
+	}
+	else if (c < 0x80)
+	{
+		length = 1;
+	}
+	else if ((c & 0xE0) == 0xC0)
+	{
+		length = 2;
+	}
+	else if ((c & 0xF8) == 0xF0)
+	{
+		length = 4;
+	}
+	else if ((c & 0xFC) == 0xF8)
+	{
+		length = 5;
+	}
+	else if ((c & 0xFE) == 0xFC)
+	{
+		length = 6;
+	}
+	else
+	{
+		throw opencc::InvalidUTF8(std::string(text, std::min<std::size_t>(left, 16)));
+	}
+
+	// OpenCC steps past the end of a character cut short by the end of the
+	// text and reads on until a NUL; usually that passes the bytes through,
+	// which is what this does.
+	return std::min(length, left);
+}
+
+// The longest match of the first dictionary in list, from first on, that
+// has any.
+std::size_t MatchFirst(std::vector<PrefixDict const *> const &list, std::size_t first, const char *text, std::size_t length, EntryView &entry)
+{
+	for (std::size_t i = first; i < list.size(); i++)
+	{
+		std::size_t matched = list[i]->MatchPrefix(text, length, entry);
+		if (matched > 0)
+		{
+			return matched;
+		}
+	}
+
+	return 0;
+}
+
+// One conversion over one segment, with match finding the key at each
+// position as MatchFirst does.
+template <typename Match, typename Output>
+void ApplyMatches(Match const &match, const char *text, std::size_t length, Output &out)
+{
+	// Unmatched characters are copied a stretch at a time.
+	std::size_t copy = 0;
+	std::size_t pos = 0;
+	while (pos < length)
+	{
+		EntryView entry;
+		std::size_t matched = match(text + pos, length - pos, entry);
+		if (matched == 0)
+		{
+			pos += NextCharLength(text + pos, length - pos);
+			continue;
+		}
+
+		out.Append(text + copy, pos - copy);
+		out.Append(entry.value, entry.value_length);
+		pos += matched;
+		copy = pos;
+	}
+
+	out.Append(text + copy, length - copy);
+}
+
+template <typename Output>
+void ApplyConversion(std::vector<PrefixDict const *> const &dicts, std::size_t first_dict, const char *text, std::size_t length, Output &out)
+{
+	ApplyMatches([&dicts, first_dict](const char *at, std::size_t left, EntryView &entry) {
+		return MatchFirst(dicts, first_dict, at, left, entry);
+	}, text, length, out);
+}
+}
+
+ConversionEngine::ConversionEngine() : fused_(false), runs_composed_(false), mapped_(nullptr)
+{
+}
+
+bool ConversionEngine::Load(opencc::Converter const &converter)
+{
+	std::shared_ptr<opencc::MaxMatchSegmentation> segmentation = std::dynamic_pointer_cast<opencc::MaxMatchSegmentation>(converter.GetSegmentation());
+	if (!segmentation)
+	{
+		return false;
+	}
+
+	AddDicts(segmentation->GetDict(), segmentation_);
+	for (opencc::ConversionPtr const &conversion : converter.GetConversionChain()->GetConversions())
+	{
+		conversions_.emplace_back();
+		AddDicts(conversion->GetDict(), conversions_.back());
+	}
+
+	fused_ = !conversions_.empty() && conversions_[0].size() >= segmentation_.size()
+		&& std::equal(segmentation_.begin(), segmentation_.end(), conversions_[0].begin());
+	Compose();
+	if (!runs_composed_)
+	{
+		ComposeRunLevels();
+	}
+
+	IndexStarts(composed_segmentation_, segmentation_starts_);
+	return true;
+}
+
+void ConversionEngine::Load(MappedDict const &dict)
+{
+	mapped_ = &dict;
+}
+
+std::string ConversionEngine::ConvertThroughChain(std::size_t first_dict, std::string const &segment) const
+{
+	std::string out;
+	StringOutput output{ out };
+	ScratchBuffers scratch(conversions_.size());
+	ConvertSegment(0, first_dict, segment.data(), segment.length(), output, scratch.buffers);
+	return out;
+}
+
+void ConversionEngine::Compose()
+{
+	for (PrefixDict const *dict : segmentation_)
+	{
+		std::vector<std::pair<std::string, std::string>> entries;
+		entries.reserve(dict->Size());
+		for (std::size_t i = 0; i < dict->Size(); i++)
+		{
+			entries.emplace_back(dict->Key(i), ConvertThroughChain(0, dict->Key(i)));
+		}
+
+		composed_.emplace_back(new PrefixDict(entries));
+		composed_segmentation_.push_back(composed_.back().get());
+	}
+
+	// Every dictionary a run meets has to match single characters only.
+	std::size_t first_dict = fused_ ? segmentation_.size() : 0;
+	std::vector<PrefixDict const *> run_dicts;
+	for (std::size_t level = 0; level < conversions_.size(); level++)
+	{
+		run_dicts.insert(run_dicts.end(), conversions_[level].begin() + (level == 0 ? first_dict : 0), conversions_[level].end());
+	}
+
+	for (PrefixDict const *dict : run_dicts)
+	{
+		if (!dict->SingleCharacterKeys())
+		{
+			return;
+		}
+	}
+
+	std::vector<std::pair<std::string, std::string>> entries;
+	for (PrefixDict const *dict : run_dicts)
+	{
+		for (std::size_t i = 0; i < dict->Size(); i++)
+		{
+			entries.emplace_back(dict->Key(i), ConvertThroughChain(first_dict, dict->Key(i)));
+		}
+	}
+
+	composed_.emplace_back(new PrefixDict(entries));
+	composed_runs_.push_back(composed_.back().get());
+	runs_composed_ = true;
+}
+
+void ConversionEngine::ComposeRunLevels()
+{
+	std::size_t first_dict = fused_ ? segmentation_.size() : 0;
+	std::vector<DictList> levels;
+	for (std::size_t level = 0; level < conversions_.size(); level++)
+	{
+		levels.emplace_back(conversions_[level].begin() + (level == 0 ? first_dict : 0), conversions_[level].end());
+	}
+
+	// A conversion whose keys are all single characters converts each piece
+	// of what the one before it emits on its own. So the values of the one
+	// before can go through it up front, and where none of that one's keys
+	// matches, its own dictionaries are tried next. Folded from the end, a
+	// conversion takes in any it has folded itself.
+	for (std::size_t level = levels.size(); level-- > 1;)
+	{
+		bool single_character = true;
+		for (PrefixDict const *dict : levels[level])
+		{
+			single_character = single_character && dict->SingleCharacterKeys();
+		}
+
+		if (!single_character)
+		{
+			continue;
+		}
+
+		DictList folded;
+		for (PrefixDict const *dict : levels[level - 1])
+		{
+			std::vector<std::pair<std::string, std::string>> entries;
+			entries.reserve(dict->Size());
+			for (std::size_t i = 0; i < dict->Size(); i++)
+			{
+				EntryView entry = dict->Entry(i);
+				std::string value;
+				StringOutput value_out{ value };
+				ApplyConversion(levels[level], 0, entry.value, entry.value_length, value_out);
+				entries.emplace_back(dict->Key(i), value);
+			}
+
+			composed_.emplace_back(new PrefixDict(entries));
+			folded.push_back(composed_.back().get());
+		}
+
+		folded.insert(folded.end(), levels[level].begin(), levels[level].end());
+		levels[level - 1].swap(folded);
+		levels.erase(levels.begin() + level);
+	}
+
+	// Without dictionaries the first conversion passes a run through as it
+	// is. A later one steps through the same characters and rejects the
+	// same malformed ones, so it can go.
+	if (levels.size() > 1 && levels[0].empty())
+	{
+		levels.erase(levels.begin());
+	}
+
+	run_levels_.resize(levels.size());
+	for (std::size_t level = 0; level < levels.size(); level++)
+	{
+		run_levels_[level].dicts.swap(levels[level]);
+		IndexStarts(run_levels_[level].dicts, run_levels_[level].starts);
+	}
+}
+
+void ConversionEngine::IndexStarts(DictList const &dicts, StartIndex &starts)
+{
+	starts = StartIndex();
+	std::vector<std::uint32_t> character_cps;
+	for (PrefixDict const *dict : dicts)
+	{
+		for (std::size_t i = 0; i < dict->Size(); i++)
+		{
+			EntryView entry = dict->Entry(i);
+			const unsigned char *p = (const unsigned char *)entry.key;
+			const unsigned char *end = p + entry.key_length;
+			unsigned first = 0;
+			std::size_t characters = 0;
+			while (p < end)
+			{
+				unsigned cp;
+				std::size_t length = ReadUtf8(p, end - p, cp);
+				if (length == 1 && *p >= 0x80)
+				{
+					starts = StartIndex();
+					return;
+				}
+
+				first = characters == 0 ? cp : first;
+				characters++;
+				p += length;
+			}
+
+			if (characters == 1)
+			{
+				character_cps.push_back(first);
+				starts.character_entries.push_back(entry);
+			}
+			else
+			{
+				starts.phrase_starts.Insert(first);
+			}
+		}
+	}
+
+	// Where several dictionaries have a character, the first one's entry is
+	// the one inserted first, and it stays.
+	starts.characters = CodepointTable(CodepointTable::DenseFor(character_cps));
+	for (std::size_t i = 0; i < character_cps.size(); i++)
+	{
+		starts.character_keys.Insert(character_cps[i]);
+		starts.characters.Insert(character_cps[i], (std::uint32_t)i);
+	}
+
+	starts.indexed = !dicts.empty();
+}
+
+std::size_t ConversionEngine::MatchIndexed(DictList const &dicts, StartIndex const &starts, const char *text, std::size_t length, EntryView &entry)
+{
+	if (!starts.indexed)
+	{
+		return MatchFirst(dicts, 0, text, length, entry);
+	}
+
+	// No key starts with a malformed character.
+	unsigned cp;
+	std::size_t cp_length = ReadUtf8((const unsigned char *)text, length, cp);
+	if (cp_length == 1 && (unsigned char)*text >= 0x80)
+	{
+		return 0;
+	}
+
+	if (starts.phrase_starts.Contains(cp))
+	{
+		return MatchFirst(dicts, 0, text, length, entry);
+	}
+
+	if (!starts.character_keys.Contains(cp))
+	{
+		return 0;
+	}
+
+	entry = starts.character_entries[starts.characters.Find(cp)];
+	return cp_length;
+}
+
+std::size_t ConversionEngine::MatchSegmentation(const char *text, std::size_t length, EntryView &entry) const
+{
+	if (mapped_ != nullptr)
+	{
+		return mapped_->MatchPrefix(text, length, entry);
+	}
+
+	return MatchIndexed(composed_segmentation_, segmentation_starts_, text, length, entry);
+}
+
+bool ConversionEngine::ComposedEntries(std::vector<std::pair<std::string, std::string>> &entries) const
+{
+	entries.clear();
+	for (PrefixDict const *dict : composed_segmentation_)
+	{
+		for (std::size_t i = 0; i < dict->Size(); i++)
+		{
+			entries.emplace_back(dict->Key(i), dict->Value(i));
+		}
+	}
+
+	// Listed after the segmentation keys, which win where both have a key:
+	// such a character is always found by segmentation, never in a run.
+	for (PrefixDict const *dict : composed_runs_)
+	{
+		for (std::size_t i = 0; i < dict->Size(); i++)
+		{
+			entries.emplace_back(dict->Key(i), dict->Value(i));
+		}
+	}
+
+	// With several segmentation dictionaries the first to match wins, which
+	// one dictionary's longest match can't express.
+	return runs_composed_ && composed_segmentation_.size() <= 1;
+}
+
+void ConversionEngine::AddDicts(opencc::DictPtr const &dict, DictList &list)
+{
+	// A group's dictionaries are tried in order and the first match wins, so
+	// nested groups flatten into one list.
+	std::shared_ptr<opencc::DictGroup> group = std::dynamic_pointer_cast<opencc::DictGroup>(dict);
+	if (group)
+	{
+		for (opencc::DictPtr const &member : group->GetDicts())
+		{
+			AddDicts(member, list);
+		}
+
+		return;
+	}
+
+	auto found = loaded_.find(dict.get());
+	if (found != loaded_.end())
+	{
+		list.push_back(found->second);
+		return;
+	}
+
+	// Profiles name the same file in several places, each loaded separately.
+	std::unique_ptr<PrefixDict> loaded(new PrefixDict(*dict->GetLexicon()));
+	PrefixDict const *same = nullptr;
+	for (std::unique_ptr<PrefixDict> const &other : dicts_)
+	{
+		if (*other == *loaded)
+		{
+			same = other.get();
+			break;
+		}
+	}
+
+	if (same == nullptr)
+	{
+		same = loaded.get();
+		dicts_.push_back(std::move(loaded));
+	}
+
+	loaded_[dict.get()] = same;
+	list.push_back(same);
+}
+
+void ConversionEngine::Convert(const char *text, std::size_t length, std::string &out) const
+{
+	// The output goes into a string sized for it up front, a copy at a time
+	// with no growing; text that the chain lengthens past the margin is
+	// converted again into one of the exact size.
+	out.resize(length + length / 16 + 64);
+	std::size_t converted = Convert(text, length, &out[0], out.length());
+	if (converted > out.length())
+	{
+		out.resize(converted);
+		Convert(text, length, &out[0], converted);
+	}
+
+	out.resize(converted);
+}
+
+std::size_t ConversionEngine::Convert(const char *text, std::size_t length, char *out, std::size_t capacity) const
+{
+	BufferOutput output{ out, capacity, 0 };
+	Run(output, text, length);
+	return output.length;
+}
+
+template <typename Output>
+void ConversionEngine::Run(Output &out, const char *text, std::size_t length) const
+{
+	// OpenCC works on C strings, so the text ends at a NUL.
+	const char *nul = (const char *)memchr(text, 0, length);
+	std::size_t end = nul != nullptr ? nul - text : length;
+	ScratchBuffers scratch(conversions_.size());
+
+	// The run of unmatched text since the last key starts at run.
+	std::size_t run = 0;
+	std::size_t pos = 0;
+	while (pos < end)
+	{
+		EntryView entry;
+		std::size_t matched = MatchSegmentation(text + pos, end - pos, entry);
+		if (matched == 0)
+		{
+			pos += NextCharLength(text + pos, end - pos);
+			continue;
+		}
+
+		if (pos > run)
+		{
+			ConvertRun(text + run, pos - run, out, scratch.buffers);
+		}
+
+		out.Append(entry.value, entry.value_length);
+		pos += matched;
+		run = pos;
+	}
+
+	if (end > run)
+	{
+		ConvertRun(text + run, end - run, out, scratch.buffers);
+	}
+}
+
+template <typename Output>
+void ConversionEngine::ConvertRun(const char *text, std::size_t length, Output &out, std::vector<std::string> &scratch) const
+{
+	if (mapped_ != nullptr)
+	{
+		out.Append(text, length);
+	}
+	else if (runs_composed_)
+	{
+		ApplyConversion(composed_runs_, 0, text, length, out);
+	}
+	else
+	{
+		ConvertRunLevels(0, text, length, out, scratch);
+	}
+}
+
+template <typename Output>
+void ConversionEngine::ConvertSegment(std::size_t level, std::size_t first_dict, const char *text, std::size_t length, Output &out, std::vector<std::string> &scratch) const
+{
+	if (level == conversions_.size())
+	{
+		out.Append(text, length);
+		return;
+	}
+
+	// The last conversion writes straight to the output; the others into
+	// a buffer that the next one reads.
+	if (level + 1 < conversions_.size())
+	{
+		std::string &next = scratch[level];
+		next.clear();
+		StringOutput next_out{ next };
+		ApplyConversion(conversions_[level], first_dict, text, length, next_out);
+		ConvertSegment(level + 1, 0, next.data(), next.length(), out, scratch);
+		return;
+	}
+
+	ApplyConversion(conversions_[level], first_dict, text, length, out);
+}
+
+template <typename Output>
+void ConversionEngine::ConvertRunLevels(std::size_t level, const char *text, std::size_t length, Output &out, std::vector<std::string> &scratch) const
+{
+	RunLevel const &run_level = run_levels_[level];
+	auto match = [&run_level](const char *at, std::size_t left, EntryView &entry) {
+		return MatchIndexed(run_level.dicts, run_level.starts, at, left, entry);
+	};
+	if (level + 1 < run_levels_.size())
+	{
+		std::string &next = scratch[level];
+		next.clear();
+		StringOutput next_out{ next };
+		ApplyMatches(match, text, length, next_out);
+		ConvertRunLevels(level + 1, next.data(), next.length(), out, scratch);
+		return;
+	}
+
+	ApplyMatches(match, text, length, out);
+}
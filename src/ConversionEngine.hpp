@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencc/Converter.hpp>
+#include "CodepointSet.hpp"
+#include "CodepointTable.hpp"
+#include "MappedDict.hpp"
+#include "PrefixDict.hpp"
+
+// Converts text exactly as an opencc::Converter with maximum-matching
+// segmentation does, in one pass and straight into the output. OpenCC first
+// splits the text into segments (the longest segmentation key at each
+// position, runs of everything else in between), then runs every segment
+// through each conversion of the chain in turn.
+//
+// A segment that is a key always converts the same way, so Load runs the
+// chain over every segmentation key once, and a key found in the text emits
+// its final output with no further lookups, however long the chain. A run
+// between keys depends on its neighbours where some conversion has keys of
+// several characters; otherwise it converts character by character, and
+// Load composes those characters too. Runs that don't compose go through the
+// chain, but a conversion of single-character keys only is folded into the
+// one before it, so s2twp.json's runs take one pass, not three. When the
+// first conversion starts with the segmentation dictionaries, as s2t.json
+// does with STPhrases, those can't match anywhere in a run and are skipped
+// there.
+//
+// Most characters start no key of two or more characters, so the key search
+// only runs at characters that do; elsewhere the most a key can match is the
+// character itself, which is looked up directly. This goes for segmentation
+// and for each conversion a run goes through.
+class ConversionEngine
+{
+public:
+	ConversionEngine();
+
+	ConversionEngine(ConversionEngine const &) = delete;
+	ConversionEngine &operator=(ConversionEngine const &) = delete;
+
+	// Returns false, leaving the engine unusable, for a converter built in a
+	// way it doesn't mirror.
+	bool Load(opencc::Converter const &converter);
+
+	// Converts with one dictionary, such as compose_profile writes, used for
+	// both segmentation and conversion. Text between its keys is left as it
+	// is, since no key matches anywhere in it. dict must outlive the engine.
+	void Load(MappedDict const &dict);
+
+	// Both throw opencc::InvalidUTF8 where OpenCC would.
+	void Convert(const char *text, std::size_t length, std::string &out) const;
+
+	// Returns the converted length; nothing past capacity is written.
+	std::size_t Convert(const char *text, std::size_t length, char *out, std::size_t capacity) const;
+
+	// Lists every segmentation key, and every key that converts inside runs
+	// where those compose, with the chain's final output for it. Returns
+	// true if that one dictionary, used for both segmentation and a single
+	// conversion, reproduces the whole profile.
+	bool ComposedEntries(std::vector<std::pair<std::string, std::string>> &entries) const;
+
+private:
+	// A conversion's dictionaries, tried in order; the first with any match
+	// at a position wins, even if a later one has a longer key.
+	typedef std::vector<PrefixDict const *> DictList;
+
+	// The first characters of a list's keys of several characters, and the
+	// entry that wins for each key of one character. At any other character
+	// the most a key can match is the character itself, so it is looked up
+	// in characters instead of searched for; character_keys turns away the
+	// many that aren't keys before the table is searched. Used only if every
+	// key is well-formed UTF-8.
+	struct StartIndex
+	{
+		StartIndex() : indexed(false)
+		{
+		}
+
+		bool indexed;
+		CodepointSet phrase_starts;
+		CodepointSet character_keys;
+		CodepointTable characters;
+		std::vector<EntryView> character_entries;
+	};
+
+	// A conversion as runs go through it.
+	struct RunLevel
+	{
+		DictList dicts;
+		StartIndex starts;
+	};
+
+	void AddDicts(opencc::DictPtr const &dict, DictList &list);
+	void Compose();
+	void ComposeRunLevels();
+	static void IndexStarts(DictList const &dicts, StartIndex &starts);
+
+	// The key at the start of text, as MatchFirst over dicts finds it.
+	static std::size_t MatchIndexed(DictList const &dicts, StartIndex const &starts, const char *text, std::size_t length, EntryView &entry);
+
+	// The segmentation key at the start of text, as MatchFirst over
+	// composed_segmentation_ finds it, with the chain's output for it as
+	// its value.
+	std::size_t MatchSegmentation(const char *text, std::size_t length, EntryView &entry) const;
+
+	// The segment's conversion through the whole chain.
+	std::string ConvertThroughChain(std::size_t first_dict, std::string const &segment) const;
+
+	template <typename Output>
+	void ConvertRun(const char *text, std::size_t length, Output &out, std::vector<std::string> &scratch) const;
+
+	template <typename Output>
+	void Run(Output &out, const char *text, std::size_t length) const;
+
+	// Runs conversion level over a segment, skipping its dictionaries before
+	// first_dict, and the rest of the chain over what that gives. A level
+	// past the end of the chain emits the segment as it is.
+	template <typename Output>
+	void ConvertSegment(std::size_t level, std::size_t first_dict, const char *text, std::size_t length, Output &out, std::vector<std::string> &scratch) const;
+
+	// As ConvertSegment, through run_levels_.
+	template <typename Output>
+	void ConvertRunLevels(std::size_t level, const char *text, std::size_t length, Output &out, std::vector<std::string> &scratch) const;
+
+	std::vector<std::unique_ptr<PrefixDict>> dicts_;
+	// Each OpenCC dictionary is read once, however often the profile names it.
+	std::map<opencc::Dict const *, PrefixDict const *> loaded_;
+	DictList segmentation_;
+	std::vector<DictList> conversions_;
+	// Whether conversions_[0] starts with segmentation_.
+	bool fused_;
+	// segmentation_ with each value replaced by the chain's output.
+	std::vector<std::unique_ptr<PrefixDict>> composed_;
+	DictList composed_segmentation_;
+	StartIndex segmentation_starts_;
+	// Set if runs convert a character at a time, through composed_runs_.
+	bool runs_composed_;
+	DictList composed_runs_;
+	// Otherwise runs go through these: the chain from the first dictionary
+	// they can meet, with each conversion whose keys are all single
+	// characters folded into the one before it.
+	std::vector<RunLevel> run_levels_;
+	// Set if loaded from one mapped dictionary, which stands in for all the
+	// above.
+	MappedDict const *mapped_;
+};
@@ -0,0 +1,369 @@
+#include "DirWalk.hpp"
+#include <iostream>
+#include <system_error>
+
+#ifdef __linux__
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+static const std::size_t kDirentBufferLength = 32 << 10;
+
+// The record getdents64 fills in; glibc only gained a declaration in 2.30.
+struct LinuxDirent64
+{
+	std::uint64_t d_ino;
+	std::int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+static DirHandlePtr OpenDir(int dir_fd, const char *name)
+{
+	int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	return fd < 0 ? DirHandlePtr() : std::make_shared<DirHandle>(fd);
+}
+
+// Files waiting in a batch or a copy queue hold their directories open, so
+// take all the descriptors the hard limit allows.
+static void RaiseOpenFileLimit()
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+namespace
+{
+// A directory found but not yet opened. Opening is left to whichever worker
+// takes it; until then it holds its parent's handles, shared with any queued
+// siblings, to open it by name. So the queue keeps open one directory per
+// parent with children waiting, not one per child.
+struct PendingDir
+{
+	FileLocation input;
+	FileLocation output;
+	std::string relative_path;
+};
+
+class ParallelWalk
+{
+public:
+	ParallelWalk(std::function<bool(WalkEntry &)> const &visit) : visit_(visit), active_(0), failed_(false), left_out_(0)
+	{
+	}
+
+	std::uint64_t Run(PendingDir root, std::size_t threads)
+	{
+		pending_.push_back(std::move(root));
+
+		std::vector<std::thread> workers;
+		for (std::size_t i = 1; i < threads; i++)
+		{
+			workers.emplace_back(&ParallelWalk::Work, this);
+		}
+
+		Work();
+		for (std::thread &worker : workers)
+		{
+			worker.join();
+		}
+
+		if (error_)
+		{
+			std::rethrow_exception(error_);
+		}
+
+		return left_out_;
+	}
+
+private:
+	// Past this many queued directories, a worker walks what it finds itself,
+	// depth first, so a tree of very wide directories can't grow the queue
+	// without bound.
+	static const std::size_t kMaxPendingDirs = 4096;
+
+	void Work()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			work_ready_.wait(lock, [this] { return failed_ || !pending_.empty() || active_ == 0; });
+			if (failed_ || pending_.empty())
+			{
+				// Nothing queued and nobody left to queue more.
+				work_ready_.notify_all();
+				return;
+			}
+
+			PendingDir dir = std::move(pending_.front());
+			pending_.pop_front();
+			active_++;
+			lock.unlock();
+
+			try
+			{
+				WalkDir(dir);
+			}
+			catch (...)
+			{
+				lock.lock();
+				if (!error_)
+				{
+					error_ = std::current_exception();
+				}
+
+				failed_ = true;
+				lock.unlock();
+			}
+
+			lock.lock();
+			active_--;
+			if (active_ == 0 || failed_)
+			{
+				work_ready_.notify_all();
+			}
+		}
+	}
+
+	void Enqueue(PendingDir &dir)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (pending_.size() < kMaxPendingDirs)
+			{
+				pending_.push_back(std::move(dir));
+				work_ready_.notify_one();
+				return;
+			}
+		}
+
+		WalkDir(dir);
+	}
+
+	void WalkDir(PendingDir &pending)
+	{
+		FileLocation input = pending.input;
+		FileLocation output = pending.output;
+		input.dir = OpenDir(AtFd(pending.input), AtName(pending.input));
+		if (input.dir)
+		{
+			output.dir = OpenDir(AtFd(pending.output), AtName(pending.output));
+		}
+
+		// The parent was needed only to open this; once its last child is
+		// opened it closes, rather than when that child's walk is done.
+		pending.input.dir.reset();
+		pending.output.dir.reset();
+		if (!input.dir || !output.dir)
+		{
+			int error = errno;
+			fs::path const &path = input.dir ? output.path : input.path;
+			// Out of descriptors, every directory after would be left out
+			// too, so the walk fails rather than carry on with gaps.
+			if (error == EMFILE || error == ENFILE)
+			{
+				throw fs::filesystem_error(std::string("open directory: ") + strerror(error), path, std::error_code(error, std::system_category()));
+			}
+
+			std::cerr << "open directory error: " << path.u8string() << ": " << strerror(error) << std::endl;
+			left_out_++;
+			return;
+		}
+
+		// Entries are handled as each buffer comes in, so a directory of
+		// millions of files costs no more memory than a small one.
+		std::vector<char> buffer(kDirentBufferLength);
+		while (!failed_)
+		{
+			long length = syscall(SYS_getdents64, input.dir->Fd(), buffer.data(), buffer.size());
+			if (length < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (length < 0)
+			{
+				std::cerr << "read directory error: " << input.path.u8string() << ": " << strerror(errno) << std::endl;
+				left_out_++;
+				return;
+			}
+
+			if (length == 0)
+			{
+				return;
+			}
+
+			for (long pos = 0; pos < length;)
+			{
+				LinuxDirent64 const *dirent = (LinuxDirent64 const *)(buffer.data() + pos);
+				pos += dirent->d_reclen;
+				VisitEntry(input, output, pending.relative_path, dirent);
+			}
+		}
+	}
+
+	void VisitEntry(FileLocation const &input, FileLocation const &output, std::string const &relative_dir, LinuxDirent64 const *dirent)
+	{
+		const char *name = dirent->d_name;
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+		{
+			return;
+		}
+
+		// Only links, and filesystems that don't fill in d_type, cost a stat
+		// to find out what they are.
+		unsigned char type = dirent->d_type;
+		struct stat st;
+		bool have_stat = false;
+		if (type == DT_LNK || type == DT_UNKNOWN)
+		{
+			if (fstatat(input.dir->Fd(), name, &st, 0) != 0)
+			{
+				return;
+			}
+
+			have_stat = true;
+			type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+		}
+
+		if (type != DT_REG && type != DT_DIR)
+		{
+			return;
+		}
+
+		WalkEntry entry;
+		entry.is_directory = type == DT_DIR;
+		entry.relative_path = relative_dir.empty() ? std::string(name) : relative_dir + '/' + name;
+		entry.size = 0;
+		entry.input.dir = input.dir;
+		entry.input.name = name;
+		entry.input.path = input.path / fs::path(name);
+		entry.output.dir = output.dir;
+		entry.output.name = name;
+		entry.output.path = output.path / fs::path(name);
+
+		if (!entry.is_directory)
+		{
+			if (!have_stat && fstatat(input.dir->Fd(), name, &st, 0) != 0)
+			{
+				std::cerr << "stat error: " << entry.input.path.u8string() << ": " << strerror(errno) << std::endl;
+				return;
+			}
+
+			entry.size = st.st_size;
+			visit_(entry);
+			return;
+		}
+
+		if (!visit_(entry))
+		{
+			return;
+		}
+
+		if (mkdirat(output.dir->Fd(), name, 0777) != 0 && errno != EEXIST)
+		{
+			std::cerr << "create directory error: " << entry.output.path.u8string() << ": " << strerror(errno) << std::endl;
+			left_out_++;
+			return;
+		}
+
+		// A linked directory is created but not followed.
+		if (dirent->d_type == DT_LNK)
+		{
+			return;
+		}
+
+		PendingDir dir;
+		dir.input = std::move(entry.input);
+		dir.output = std::move(entry.output);
+		dir.relative_path = std::move(entry.relative_path);
+		Enqueue(dir);
+	}
+
+	std::function<bool(WalkEntry &)> const &visit_;
+	std::deque<PendingDir> pending_;
+	std::mutex mutex_;
+	std::condition_variable work_ready_;
+	// Workers in WalkDir, who may yet queue more.
+	std::size_t active_;
+	std::atomic<bool> failed_;
+	std::exception_ptr error_;
+	// Directories that couldn't be opened, read or created.
+	std::atomic<std::uint64_t> left_out_;
+};
+}
+
+std::uint64_t WalkTree(fs::path const &input_root, fs::path const &output_root, std::size_t threads, std::function<bool(WalkEntry &)> const &visit)
+{
+	RaiseOpenFileLimit();
+
+	// The roots are opened up front only to fail early, before any thread starts.
+	if (!OpenDir(AT_FDCWD, input_root.c_str()))
+	{
+		throw fs::filesystem_error("open directory", input_root, std::error_code(errno, std::system_category()));
+	}
+
+	if (!OpenDir(AT_FDCWD, output_root.c_str()))
+	{
+		throw fs::filesystem_error("open directory", output_root, std::error_code(errno, std::system_category()));
+	}
+
+	PendingDir root;
+	root.input.path = input_root;
+	root.output.path = output_root;
+	ParallelWalk walk(visit);
+	return walk.Run(std::move(root), threads == 0 ? 1 : threads);
+}
+#else
+std::uint64_t WalkTree(fs::path const &input_root, fs::path const &output_root, std::size_t threads, std::function<bool(WalkEntry &)> const &visit)
+{
+	for (auto rdi = fs::recursive_directory_iterator(input_root); rdi != fs::recursive_directory_iterator(); ++rdi)
+	{
+		fs::directory_entry const &de = *rdi;
+		if (!de.is_regular_file() && !de.is_directory())
+		{
+			continue;
+		}
+
+		WalkEntry entry;
+		entry.is_directory = de.is_directory();
+		entry.relative_path = de.path().lexically_relative(input_root).generic_u8string();
+		entry.size = entry.is_directory ? 0 : de.file_size();
+		entry.input.name = de.path().filename().u8string();
+		entry.input.path = de.path();
+		entry.output.name = entry.input.name;
+		entry.output.path = output_root / fs::u8path(entry.relative_path);
+
+		if (!visit(entry))
+		{
+			if (entry.is_directory)
+			{
+				rdi.disable_recursion_pending();
+			}
+
+			continue;
+		}
+
+		if (entry.is_directory)
+		{
+			fs::create_directories(entry.output.path);
+		}
+	}
+
+	return 0;
+}
+#endif
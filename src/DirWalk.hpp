@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "FileLocation.hpp"
+
+struct WalkEntry
+{
+	bool is_directory;
+	// Relative to the input root, '/'-separated.
+	std::string relative_path;
+	// Regular files only.
+	std::uint64_t size;
+	FileLocation input;
+	// Same name in the matching output directory.
+	FileLocation output;
+};
+
+// Walks the input tree, reporting every regular file and directory
+// (symlinks count as what they point to, but linked directories aren't
+// descended). Each directory visit returns true to have the directory created
+// in the output tree and walked, or false to leave it out.
+//
+// On Linux each directory is opened on both sides and its entries read with
+// getdents64, using d_type to tell files from directories, so every open,
+// stat and mkdir resolves a single name. Directories are shared out to the
+// given number of threads, which call visit concurrently. A directory that
+// can't be opened, read or created in the output is reported and left out
+// with everything beneath it; the count of those is returned. Throws
+// fs::filesystem_error if a root can't be opened or the process runs out of
+// descriptors, and rethrows the first exception out of visit, once every
+// thread has stopped.
+std::uint64_t WalkTree(fs::path const &input_root, fs::path const &output_root, std::size_t threads, std::function<bool(WalkEntry &)> const &visit);
@@ -0,0 +1,159 @@
+#include "Durability.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// Left behind only by a run that was cut short.
+static const char kTempSuffix[] = ".cc-tmp";
+
+Durability::Durability(std::string const &mode, fs::path const &output_root)
+	: mode_(mode), staged_(mode == "fsync"), output_root_(output_root)
+{
+	if (mode != "none" && mode != "syncfs" && mode != "fsync")
+	{
+		throw std::runtime_error("invalid durability: " + mode);
+	}
+}
+
+FileLocation Durability::Target(FileLocation const &output) const
+{
+	FileLocation target = output;
+	if (staged_)
+	{
+		target.name += kTempSuffix;
+		target.path += kTempSuffix;
+	}
+
+	return target;
+}
+
+#ifdef _WIN32
+int Durability::Commit(FileLocation const &output)
+{
+	if (!staged_)
+	{
+		return 0;
+	}
+
+	std::error_code ec;
+	fs::rename(Target(output).path, output.path, ec);
+	if (ec)
+	{
+		std::cerr << "rename error: " << output.path.u8string() << ": " << ec.message() << std::endl;
+		return ec.value();
+	}
+
+	return 0;
+}
+
+int Durability::Finish()
+{
+	if (mode_ != "none")
+	{
+		std::cerr << "durability " << mode_ << " does not flush on this platform" << std::endl;
+	}
+
+	return 0;
+}
+#else
+int Durability::Commit(FileLocation const &output)
+{
+	if (!staged_)
+	{
+		return 0;
+	}
+
+	// Reopened rather than synced by each writer, so the I/O backends, the
+	// copies and the streamed files all go through this one place.
+	FileLocation temp = Target(output);
+	int error = 0;
+	int fd = openat(AtFd(temp), AtName(temp), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		error = errno;
+	}
+	else
+	{
+		if (fsync(fd) != 0)
+		{
+			error = errno;
+		}
+
+		close(fd);
+	}
+
+	if (error == 0 && renameat(AtFd(temp), AtName(temp), AtFd(output), AtName(output)) != 0)
+	{
+		error = errno;
+	}
+
+	if (error != 0)
+	{
+		std::cerr << "sync error: " << output.path.u8string() << ": " << strerror(error) << std::endl;
+		return error;
+	}
+
+	std::string root = output_root_.u8string();
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (fs::path dir = output.path.parent_path(); !dir.empty(); dir = dir.parent_path())
+	{
+		std::string name = dir.u8string();
+		if (name.length() <= root.length() || !directories_.insert(name).second)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int Durability::Finish()
+{
+	if (mode_ == "none")
+	{
+		return 0;
+	}
+
+	int ret = 0;
+	if (mode_ == "fsync")
+	{
+		directories_.insert(output_root_.u8string());
+		for (std::string const &dir : directories_)
+		{
+			int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0 || fsync(fd) != 0)
+			{
+				std::cerr << "sync error: " << dir << ": " << strerror(errno) << std::endl;
+				ret = -1;
+			}
+
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+
+		return ret;
+	}
+
+#ifdef __linux__
+	int fd = open(output_root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || syncfs(fd) != 0)
+	{
+		std::cerr << "sync error: " << output_root_.u8string() << ": " << strerror(errno) << std::endl;
+		ret = -1;
+	}
+
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+#else
+	// Without syncfs, everything gets flushed.
+	sync();
+#endif
+
+	return ret;
+}
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <mutex>
+#include <set>
+#include <string>
+#include "FileLocation.hpp"
+
+// How far outputs are pushed to stable storage before the run reports done.
+// "none" leaves it to the kernel. "syncfs" flushes the whole output
+// filesystem once at the end. "fsync" writes each output under a temporary
+// name, fsyncs it and renames it into place, so that a crash leaves either
+// the whole file or none of it; the directories renamed into are fsynced
+// once each at the end rather than after every rename.
+class Durability
+{
+public:
+	// Throws std::runtime_error for an unknown mode.
+	Durability(std::string const &mode, fs::path const &output_root);
+
+	Durability(Durability const &) = delete;
+	Durability &operator=(Durability const &) = delete;
+
+	// Where the output is to be written: itself, or in fsync mode a
+	// temporary file beside it.
+	FileLocation Target(FileLocation const &output) const;
+
+	bool Staged() const
+	{
+		return staged_;
+	}
+
+	// Makes a fully written Target(output) durable and moves it into place.
+	// Returns 0, or an errno value after reporting it.
+	int Commit(FileLocation const &output);
+
+	// Runs the end-of-run flush. Returns 0, or -1 after reporting an error.
+	int Finish();
+
+	std::string const &Mode() const
+	{
+		return mode_;
+	}
+
+private:
+	std::string mode_;
+	bool staged_;
+	fs::path output_root_;
+	// Directories that had files renamed into them, and their parents up to
+	// the output root, which got new entries as they were created.
+	std::set<std::string> directories_;
+	std::mutex mutex_;
+};
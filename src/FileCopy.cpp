@@ -0,0 +1,164 @@
+#include "FileCopy.hpp"
+#include <iostream>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
+static const std::size_t kCopyBufferLength = 4 << 20;
+
+// Called through syscall() so that older glibc without the wrapper still builds.
+static ssize_t CopyFileRange(int in_fd, int out_fd, std::size_t length)
+{
+#ifdef __NR_copy_file_range
+	return syscall(__NR_copy_file_range, in_fd, nullptr, out_fd, nullptr, length, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int CopyFd(int in_fd, int out_fd, off_t size)
+{
+	// A reflink shares the extents outright on btrfs, XFS and the like.
+#ifdef FICLONE
+	if (size > 0 && ioctl(out_fd, FICLONE, in_fd) == 0)
+	{
+		return 0;
+	}
+#endif
+
+	// Each step below picks up wherever the one before it stopped, through
+	// the file offsets of the two descriptors.
+	off_t copied = 0;
+	while (copied < size)
+	{
+		ssize_t ret = CopyFileRange(in_fd, out_fd, size - copied);
+		if (ret <= 0)
+		{
+			break;
+		}
+
+		copied += ret;
+	}
+
+	// copy_file_range refuses to cross filesystems before Linux 5.3, while
+	// sendfile has taken a regular file as input since 2.6.33.
+	while (copied < size)
+	{
+		ssize_t ret = sendfile(out_fd, in_fd, nullptr, size - copied);
+		if (ret <= 0)
+		{
+			break;
+		}
+
+		copied += ret;
+	}
+
+	if (copied == size)
+	{
+		return 0;
+	}
+
+	if (lseek(in_fd, copied, SEEK_SET) < 0 || lseek(out_fd, copied, SEEK_SET) < 0)
+	{
+		return -1;
+	}
+
+	static thread_local std::vector<char> buffer(kCopyBufferLength);
+	while (true)
+	{
+		ssize_t read_len = read(in_fd, buffer.data(), buffer.size());
+		if (read_len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		if (read_len == 0)
+		{
+			return 0;
+		}
+
+		for (ssize_t written = 0; written < read_len;)
+		{
+			ssize_t ret = write(out_fd, buffer.data() + written, read_len - written);
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				return -1;
+			}
+
+			written += ret;
+		}
+	}
+}
+
+int CopyFileFast(FileLocation const &from, FileLocation const &to)
+{
+	int in_fd = openat(AtFd(from), AtName(from), O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0)
+	{
+		std::cerr << "open error: " << from.path.u8string() << std::endl;
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(in_fd, &st) != 0)
+	{
+		std::cerr << "stat error: " << from.path.u8string() << std::endl;
+		close(in_fd);
+		return -1;
+	}
+
+	int out_fd = openat(AtFd(to), AtName(to), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+	if (out_fd < 0)
+	{
+		std::cerr << "open error: " << to.path.u8string() << std::endl;
+		close(in_fd);
+		return -1;
+	}
+
+	int ret = CopyFd(in_fd, out_fd, st.st_size);
+	if (ret != 0)
+	{
+		std::cerr << "copy error: " << from.path.u8string() << std::endl;
+	}
+
+	close(in_fd);
+	if (close(out_fd) != 0)
+	{
+		ret = -1;
+	}
+
+	return ret;
+}
+#else
+int CopyFileFast(FileLocation const &from, FileLocation const &to)
+{
+	std::error_code ec;
+	fs::copy_file(from.path, to.path, fs::copy_options::overwrite_existing, ec);
+	if (ec)
+	{
+		std::cerr << "copy error: " << from.path.u8string() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+#endif
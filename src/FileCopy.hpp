@@ -0,0 +1,9 @@
+#pragma once
+
+#include "FileLocation.hpp"
+
+// Copies a file without passing its content through user space where the
+// platform allows: a FICLONE reflink first, then copy_file_range, then
+// sendfile, and a read/write loop with a large buffer as the last resort.
+// Safe to call from several threads. Returns 0 on success, -1 on error.
+int CopyFileFast(FileLocation const &from, FileLocation const &to);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <ghc/filesystem.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = ghc::filesystem;
+
+// An open directory that files are opened relative to. It is closed with the
+// last reference, so files still queued keep their directory open.
+class DirHandle
+{
+public:
+	explicit DirHandle(int fd) : fd_(fd)
+	{
+	}
+
+	~DirHandle()
+	{
+#ifndef _WIN32
+		close(fd_);
+#endif
+	}
+
+	DirHandle(DirHandle const &) = delete;
+	DirHandle &operator=(DirHandle const &) = delete;
+
+	int Fd() const
+	{
+		return fd_;
+	}
+
+private:
+	int fd_;
+};
+
+typedef std::shared_ptr<DirHandle> DirHandlePtr;
+
+// A file named relative to an open directory, so the kernel resolves one
+// component instead of the whole path. Without a directory the full path is
+// used; the path is always filled in for messages.
+struct FileLocation
+{
+	DirHandlePtr dir;
+	std::string name;
+	fs::path path;
+};
+
+#ifndef _WIN32
+// The descriptor and name to pass to openat() and the other *at calls.
+inline int AtFd(FileLocation const &file)
+{
+	return file.dir ? file.dir->Fd() : AT_FDCWD;
+}
+
+inline const char *AtName(FileLocation const &file)
+{
+	return file.dir ? file.name.c_str() : file.path.c_str();
+}
+#endif
@@ -0,0 +1,609 @@
+#include "IoBackend.hpp"
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// The open, read, write, fallocate and close opcodes all arrived in Linux 5.6.
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+#define CC_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+// Outputs this big get their blocks reserved in one go before the write;
+// for smaller ones the extra call isn't worth it.
+static const std::size_t kPreallocateLength = 1 << 20;
+
+// Reads are sized to the file as the walk found it, with a byte to spare so
+// that a read of nothing can show the end was reached. A file that has grown
+// since fills that byte, and the buffer is grown to take the rest.
+static std::size_t ReadLength(std::uint64_t size)
+{
+	return (std::size_t)size + 1;
+}
+
+static void GrowForRead(std::string &data)
+{
+	data.resize(data.length() * 2);
+}
+
+class PosixIoBackend : public IoBackend
+{
+public:
+	virtual const char *Name() const
+	{
+		return "posix";
+	}
+
+	virtual void ReadFiles(std::vector<IoFile> &files)
+	{
+		for (IoFile &file : files)
+		{
+			ReadFile(file);
+		}
+	}
+
+	virtual void WriteFiles(std::vector<IoFile> &files)
+	{
+		for (IoFile &file : files)
+		{
+			WriteFile(file);
+		}
+	}
+
+private:
+#ifdef _WIN32
+	static void ReadFile(IoFile &file)
+	{
+		file.error = 0;
+		fs::ifstream ifs;
+		ifs.open(file.location.path, std::ios::binary);
+		if (!ifs.is_open())
+		{
+			file.error = ENOENT;
+			return;
+		}
+
+		file.data.resize(file.size);
+		ifs.read(&file.data[0], file.size);
+		file.data.resize((std::size_t)ifs.gcount());
+		// Whatever the file has grown by since it was scanned.
+		file.data.append(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	}
+
+	static void WriteFile(IoFile &file)
+	{
+		file.error = 0;
+		fs::ofstream ofs;
+		ofs.open(file.location.path, std::ios::binary);
+		if (!ofs.is_open())
+		{
+			file.error = EACCES;
+			return;
+		}
+
+		ofs.write(file.data.data(), file.data.length());
+		ofs.close();
+		file.error = ofs.fail() ? EIO : 0;
+	}
+#else
+	static void ReadFile(IoFile &file)
+	{
+		file.error = 0;
+		int fd = openat(AtFd(file.location), AtName(file.location), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			file.error = errno;
+			return;
+		}
+
+		file.data.resize(ReadLength(file.size));
+		std::size_t done = 0;
+		for (;;)
+		{
+			if (done == file.data.length())
+			{
+				GrowForRead(file.data);
+			}
+
+			ssize_t ret = read(fd, &file.data[done], file.data.length() - done);
+			if (ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (ret < 0)
+			{
+				file.error = errno;
+				break;
+			}
+
+			if (ret == 0)
+			{
+				break;
+			}
+
+			done += ret;
+		}
+
+		// The file may have shrunk or grown since it was scanned.
+		file.data.resize(done);
+		close(fd);
+	}
+
+	static void WriteFile(IoFile &file)
+	{
+		file.error = 0;
+		int fd = openat(AtFd(file.location), AtName(file.location), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (fd < 0)
+		{
+			file.error = errno;
+			return;
+		}
+
+#ifdef __linux__
+		// Filesystems without fallocate just skip it.
+		if (file.data.length() >= kPreallocateLength)
+		{
+			fallocate(fd, 0, 0, (off_t)file.data.length());
+		}
+#endif
+
+		std::size_t done = 0;
+		while (done < file.data.length())
+		{
+			ssize_t ret = write(fd, file.data.data() + done, file.data.length() - done);
+			if (ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (ret < 0)
+			{
+				file.error = errno;
+				break;
+			}
+
+			done += ret;
+		}
+
+		if (close(fd) != 0 && file.error == 0)
+		{
+			file.error = errno;
+		}
+	}
+#endif
+};
+
+#ifdef CC_HAVE_IO_URING
+// A minimal io_uring driven through the raw system calls, so there is no
+// liburing dependency. A batch goes through one phase per operation (open
+// every file, read or write every file, close every file), each phase
+// keeping up to a ring's worth of operations in flight.
+class UringIoBackend : public IoBackend
+{
+public:
+	UringIoBackend() : ring_fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sqes_(nullptr), failed_(false)
+	{
+	}
+
+	virtual ~UringIoBackend()
+	{
+		if (sqes_ != nullptr)
+		{
+			munmap(sqes_, sqes_length_);
+		}
+
+		if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+		{
+			munmap(cq_ptr_, cq_length_);
+		}
+
+		if (sq_ptr_ != MAP_FAILED)
+		{
+			munmap(sq_ptr_, sq_length_);
+		}
+
+		if (ring_fd_ >= 0)
+		{
+			close(ring_fd_);
+		}
+	}
+
+	// Returns -1 if the kernel lacks io_uring or any of the opcodes used.
+	int Init(unsigned entries)
+	{
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		ring_fd_ = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if (ring_fd_ < 0)
+		{
+			return -1;
+		}
+
+		entries_ = params.sq_entries;
+		sq_length_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cq_length_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			sq_length_ = cq_length_ = sq_length_ > cq_length_ ? sq_length_ : cq_length_;
+		}
+
+		sq_ptr_ = mmap(nullptr, sq_length_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+		if (sq_ptr_ == MAP_FAILED)
+		{
+			return -1;
+		}
+
+		cq_ptr_ = sq_ptr_;
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+		{
+			cq_ptr_ = mmap(nullptr, cq_length_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+			if (cq_ptr_ == MAP_FAILED)
+			{
+				return -1;
+			}
+		}
+
+		sqes_length_ = params.sq_entries * sizeof(struct io_uring_sqe);
+		void *sqes = mmap(nullptr, sqes_length_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+		{
+			return -1;
+		}
+
+		sqes_ = (struct io_uring_sqe *)sqes;
+		char *sq = (char *)sq_ptr_;
+		sq_head_ = (unsigned *)(sq + params.sq_off.head);
+		sq_tail_ = (unsigned *)(sq + params.sq_off.tail);
+		sq_mask_ = *(unsigned *)(sq + params.sq_off.ring_mask);
+		sq_array_ = (unsigned *)(sq + params.sq_off.array);
+		char *cq = (char *)cq_ptr_;
+		cq_head_ = (unsigned *)(cq + params.cq_off.head);
+		cq_tail_ = (unsigned *)(cq + params.cq_off.tail);
+		cq_mask_ = *(unsigned *)(cq + params.cq_off.ring_mask);
+		cqes_ = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+		return SupportsOpcodes() ? 0 : -1;
+	}
+
+	virtual const char *Name() const
+	{
+		return "io_uring";
+	}
+
+	virtual void ReadFiles(std::vector<IoFile> &files)
+	{
+		if (failed_)
+		{
+			fallback_.ReadFiles(files);
+			return;
+		}
+
+		std::vector<int> fds(files.size(), -1);
+		std::vector<std::size_t> done(files.size(), 0);
+
+		Open(files, fds, O_RDONLY | O_CLOEXEC);
+
+		std::vector<std::size_t> reads;
+		for (std::size_t i = 0; i < files.size(); i++)
+		{
+			if (fds[i] >= 0)
+			{
+				files[i].data.resize(ReadLength(files[i].size));
+				reads.push_back(i);
+			}
+		}
+
+		RunPhase(reads,
+			[&](std::size_t i, struct io_uring_sqe *sqe) {
+				Prepare(sqe, IORING_OP_READ, fds[i], &files[i].data[done[i]], files[i].data.length() - done[i], done[i]);
+			},
+			[&](std::size_t i, int res) {
+				if (res < 0)
+				{
+					files[i].error = -res;
+					return false;
+				}
+
+				// Reads go round until one returns nothing at the end of the
+				// file, wherever that now is.
+				done[i] += res;
+				if (done[i] == files[i].data.length())
+				{
+					GrowForRead(files[i].data);
+				}
+
+				return res > 0;
+			});
+
+		for (std::size_t i = 0; i < files.size(); i++)
+		{
+			if (fds[i] >= 0)
+			{
+				files[i].data.resize(done[i]);
+			}
+		}
+
+		Close(files, fds);
+		if (failed_)
+		{
+			fallback_.ReadFiles(files);
+		}
+	}
+
+	virtual void WriteFiles(std::vector<IoFile> &files)
+	{
+		if (failed_)
+		{
+			fallback_.WriteFiles(files);
+			return;
+		}
+
+		std::vector<int> fds(files.size(), -1);
+		std::vector<std::size_t> done(files.size(), 0);
+
+		Open(files, fds, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+
+		std::vector<std::size_t> preallocates;
+		std::vector<std::size_t> writes;
+		for (std::size_t i = 0; i < files.size(); i++)
+		{
+			if (fds[i] >= 0 && !files[i].data.empty())
+			{
+				writes.push_back(i);
+			}
+
+			if (fds[i] >= 0 && files[i].data.length() >= kPreallocateLength)
+			{
+				preallocates.push_back(i);
+			}
+		}
+
+		// Failures are ignored, as the write that follows doesn't need it.
+		RunPhase(preallocates,
+			[&](std::size_t i, struct io_uring_sqe *sqe) {
+				Prepare(sqe, IORING_OP_FALLOCATE, fds[i], nullptr, 0, 0);
+				sqe->addr = files[i].data.length();
+			},
+			[&](std::size_t, int) {
+				return false;
+			});
+
+		RunPhase(writes,
+			[&](std::size_t i, struct io_uring_sqe *sqe) {
+				Prepare(sqe, IORING_OP_WRITE, fds[i], (void *)(files[i].data.data() + done[i]), files[i].data.length() - done[i], done[i]);
+			},
+			[&](std::size_t i, int res) {
+				if (res < 0)
+				{
+					files[i].error = -res;
+					return false;
+				}
+
+				done[i] += res;
+				return res > 0 && done[i] < files[i].data.length();
+			});
+
+		Close(files, fds);
+		if (failed_)
+		{
+			fallback_.WriteFiles(files);
+		}
+	}
+
+private:
+	bool SupportsOpcodes()
+	{
+		std::size_t length = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+		std::vector<char> buffer(length, 0);
+		struct io_uring_probe *probe = (struct io_uring_probe *)buffer.data();
+		if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0)
+		{
+			return false;
+		}
+
+		const int opcodes[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FALLOCATE, IORING_OP_CLOSE };
+		for (int opcode : opcodes)
+		{
+			if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	static void Prepare(struct io_uring_sqe *sqe, int opcode, int fd, void *addr, std::size_t length, std::uint64_t offset)
+	{
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = (std::uint8_t)opcode;
+		sqe->fd = fd;
+		sqe->addr = (std::uint64_t)(std::uintptr_t)addr;
+		sqe->len = (std::uint32_t)(length > 0x7FFFF000 ? 0x7FFFF000 : length);
+		sqe->off = offset;
+	}
+
+	void Open(std::vector<IoFile> &files, std::vector<int> &fds, int flags)
+	{
+		std::vector<std::size_t> opens;
+		for (std::size_t i = 0; i < files.size(); i++)
+		{
+			files[i].error = 0;
+			opens.push_back(i);
+		}
+
+		RunPhase(opens,
+			[&](std::size_t i, struct io_uring_sqe *sqe) {
+				Prepare(sqe, IORING_OP_OPENAT, AtFd(files[i].location), (void *)AtName(files[i].location), 0, 0);
+				sqe->open_flags = (std::uint32_t)flags;
+				sqe->len = 0666;
+			},
+			[&](std::size_t i, int res) {
+				if (res < 0)
+				{
+					files[i].error = -res;
+				}
+				else
+				{
+					fds[i] = res;
+				}
+
+				return false;
+			});
+	}
+
+	void Close(std::vector<IoFile> &files, std::vector<int> &fds)
+	{
+		std::vector<std::size_t> closes;
+		for (std::size_t i = 0; i < fds.size(); i++)
+		{
+			if (fds[i] >= 0)
+			{
+				closes.push_back(i);
+			}
+		}
+
+		RunPhase(closes,
+			[&](std::size_t i, struct io_uring_sqe *sqe) {
+				Prepare(sqe, IORING_OP_CLOSE, fds[i], nullptr, 0, 0);
+			},
+			[&](std::size_t i, int res) {
+				if (res < 0 && files[i].error == 0)
+				{
+					files[i].error = -res;
+				}
+
+				fds[i] = -1;
+				return false;
+			});
+
+		// Only left open if the ring itself failed.
+		for (int fd : fds)
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+	}
+
+	// Keeps up to a ring's worth of the items in flight. complete returns true
+	// if the item needs another round, such as the rest of a short read.
+	template <typename Prepare, typename Complete>
+	void RunPhase(std::vector<std::size_t> const &items, Prepare prepare, Complete complete)
+	{
+		std::deque<std::size_t> pending(items.begin(), items.end());
+		unsigned in_flight = 0;
+		while (!failed_ && (!pending.empty() || in_flight > 0))
+		{
+			unsigned tail = *sq_tail_;
+			unsigned queued = 0;
+			while (!pending.empty() && in_flight + queued < entries_)
+			{
+				std::size_t i = pending.front();
+				pending.pop_front();
+				unsigned index = (tail + queued) & sq_mask_;
+				prepare(i, &sqes_[index]);
+				sqes_[index].user_data = i;
+				sq_array_[index] = index;
+				queued++;
+			}
+
+			__atomic_store_n(sq_tail_, tail + queued, __ATOMIC_RELEASE);
+			in_flight += queued;
+
+			long ret;
+			do
+			{
+				unsigned unsubmitted = tail + queued - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+				ret = syscall(__NR_io_uring_enter, ring_fd_, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			} while (ret < 0 && errno == EINTR);
+
+			if (ret < 0)
+			{
+				std::cerr << "io_uring_enter error: " << strerror(errno) << ", using posix" << std::endl;
+				failed_ = true;
+				break;
+			}
+
+			unsigned head = *cq_head_;
+			unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+			for (; head != cq_tail; head++)
+			{
+				struct io_uring_cqe const &cqe = cqes_[head & cq_mask_];
+				in_flight--;
+				if (complete((std::size_t)cqe.user_data, cqe.res))
+				{
+					pending.push_back((std::size_t)cqe.user_data);
+				}
+			}
+
+			__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		}
+
+	}
+
+	int ring_fd_;
+	unsigned entries_;
+	void *sq_ptr_;
+	void *cq_ptr_;
+	std::size_t sq_length_;
+	std::size_t cq_length_;
+	std::size_t sqes_length_;
+	unsigned *sq_head_;
+	unsigned *sq_tail_;
+	unsigned sq_mask_;
+	unsigned *sq_array_;
+	struct io_uring_sqe *sqes_;
+	unsigned *cq_head_;
+	unsigned *cq_tail_;
+	unsigned cq_mask_;
+	struct io_uring_cqe *cqes_;
+	// Set if the ring itself stopped working; everything from then on goes
+	// through the fallback.
+	bool failed_;
+	PosixIoBackend fallback_;
+};
+#endif
+
+static const unsigned kUringEntries = 256;
+
+std::unique_ptr<IoBackend> NewIoBackend(std::string const &name)
+{
+	if (name == "io_uring")
+	{
+#ifdef CC_HAVE_IO_URING
+		std::unique_ptr<UringIoBackend> backend(new UringIoBackend());
+		if (backend->Init(kUringEntries) == 0)
+		{
+			return backend;
+		}
+
+		std::cerr << "io_uring is not supported by this kernel, using posix" << std::endl;
+#else
+		std::cerr << "io_uring is not available in this build, using posix" << std::endl;
+#endif
+	}
+	else if (name != "posix")
+	{
+		std::cerr << "unknown io_backend " << name << ", using posix" << std::endl;
+	}
+
+	return std::unique_ptr<IoBackend>(new PosixIoBackend());
+}
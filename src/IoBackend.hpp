@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FileLocation.hpp"
+
+// One file of a batch read or write.
+struct IoFile
+{
+	FileLocation location;
+	// Expected size when reading, taken from the directory scan. Reads go
+	// on to the end of the file, should it have grown since.
+	std::uint64_t size;
+	// Read into, or written from.
+	std::string data;
+	// 0 or an errno value.
+	int error;
+
+	IoFile() : size(0), error(0)
+	{
+	}
+};
+
+// Reads and writes whole files a batch at a time, so that a backend can keep
+// many of them in flight together.
+class IoBackend
+{
+public:
+	virtual ~IoBackend()
+	{
+	}
+
+	virtual const char *Name() const = 0;
+
+	virtual void ReadFiles(std::vector<IoFile> &files) = 0;
+
+	// Creates or truncates each file and writes its data.
+	virtual void WriteFiles(std::vector<IoFile> &files) = 0;
+};
+
+// "posix" for plain blocking calls, or "io_uring" on Linux, which falls back
+// to posix with a warning if the kernel doesn't support it.
+std::unique_ptr<IoBackend> NewIoBackend(std::string const &name);
@@ -0,0 +1,329 @@
+#include "MappedDict.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <opencc/Exception.hpp>
+#include <opencc/Lexicon.hpp>
+#include "PrefixDict.hpp"
+#include "Utf8.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+const char kMagic[8] = { 'C', 'C', 'D', 'I', 'C', 'T', '1', 0 };
+const std::uint32_t kByteOrder = 0x01020304;
+
+std::size_t Align4(std::size_t length)
+{
+	return (length + 3) & ~(std::size_t)3;
+}
+
+// The first character of text, or 0 if it isn't a well-formed one.
+std::size_t FirstCharacter(const char *text, std::size_t length, unsigned &cp)
+{
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	std::size_t cp_length = ReadUtf8((const unsigned char *)text, length, cp);
+	return cp_length == 1 && (unsigned char)text[0] >= 0x80 ? 0 : cp_length;
+}
+
+void WritePadded(std::ofstream &ofs, const void *data, std::size_t length)
+{
+	static const char zeros[4] = {};
+	ofs.write((const char *)data, length);
+	ofs.write(zeros, Align4(length) - length);
+}
+}
+
+MappedDict::MappedDict() : mapping_(nullptr), mapping_length_(0), header_(nullptr), key_offsets_(nullptr), value_offsets_(nullptr), roots_(nullptr), key_pool_(nullptr), value_pool_(nullptr)
+{
+}
+
+MappedDict::~MappedDict()
+{
+#ifndef _WIN32
+	if (mapping_ != nullptr)
+	{
+		munmap(mapping_, mapping_length_);
+	}
+#endif
+}
+
+std::shared_ptr<MappedDict> MappedDict::NewFromFile(std::string const &file)
+{
+	std::shared_ptr<MappedDict> dict(new MappedDict());
+	const char *data = nullptr;
+	std::size_t length = 0;
+#ifndef _WIN32
+	int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		throw opencc::FileNotFound(file);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header))
+	{
+		void *mapping = mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			dict->mapping_ = mapping;
+			dict->mapping_length_ = (std::size_t)st.st_size;
+			data = (const char *)mapping;
+			length = dict->mapping_length_;
+		}
+	}
+
+	close(fd);
+#else
+	std::ifstream ifs(file, std::ios::binary);
+	if (!ifs)
+	{
+		throw opencc::FileNotFound(file);
+	}
+
+	dict->copy_.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	data = dict->copy_.data();
+	length = dict->copy_.size();
+#endif
+
+	// Sections are checked to lie within the file, offsets to run in order
+	// within their pools, keys to be sorted and unique and a root's keys to
+	// start with its character. Each step of a lookup then only reads bytes
+	// of keys long enough to have them, so none can read past the end.
+	if (data == nullptr || length < sizeof(Header))
+	{
+		throw opencc::InvalidFormat(file + " is not a .ccd dictionary");
+	}
+
+	Header const *header = (Header const *)data;
+	if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->byte_order != kByteOrder)
+	{
+		throw opencc::InvalidFormat(file + " is not a .ccd dictionary");
+	}
+
+	std::uint64_t offsets_length = ((std::uint64_t)header->count + 1) * sizeof(std::uint32_t);
+	std::uint64_t needed = sizeof(Header) + 2 * offsets_length + (std::uint64_t)header->root_count * sizeof(Root) + Align4(header->key_pool_length) + Align4(header->value_pool_length);
+	if (needed > length)
+	{
+		throw opencc::InvalidFormat(file + " is truncated");
+	}
+
+	const char *p = data + sizeof(Header);
+	dict->header_ = header;
+	dict->key_offsets_ = (std::uint32_t const *)p;
+	p += offsets_length;
+	dict->value_offsets_ = (std::uint32_t const *)p;
+	p += offsets_length;
+	dict->roots_ = (Root const *)p;
+	p += header->root_count * sizeof(Root);
+	dict->key_pool_ = p;
+	p += Align4(header->key_pool_length);
+	dict->value_pool_ = p;
+
+	for (std::uint32_t i = 0; i < header->count; i++)
+	{
+		if (dict->key_offsets_[i] > dict->key_offsets_[i + 1] || dict->value_offsets_[i] > dict->value_offsets_[i + 1])
+		{
+			throw opencc::InvalidFormat(file + " has entries out of order");
+		}
+	}
+
+	if (dict->key_offsets_[0] != 0 || dict->key_offsets_[header->count] != header->key_pool_length
+		|| dict->value_offsets_[0] != 0 || dict->value_offsets_[header->count] != header->value_pool_length)
+	{
+		throw opencc::InvalidFormat(file + " has entries outside its pools");
+	}
+
+	for (std::uint32_t i = 0; i < header->count; i++)
+	{
+		std::size_t key_length = dict->KeyLength(i);
+		if (key_length == 0 || key_length > header->max_key_length)
+		{
+			throw opencc::InvalidFormat(file + " has a key of a bad length");
+		}
+
+		if (i > 0)
+		{
+			std::size_t previous_length = dict->KeyLength(i - 1);
+			int c = memcmp(dict->KeyData(i - 1), dict->KeyData(i), std::min(previous_length, key_length));
+			if (c > 0 || (c == 0 && previous_length >= key_length))
+			{
+				throw opencc::InvalidFormat(file + " has keys out of order");
+			}
+		}
+	}
+
+	for (std::uint32_t i = 0; i < header->root_count; i++)
+	{
+		Root const &root = dict->roots_[i];
+		if (root.first >= root.last || root.last > header->count
+			|| (i > 0 && (dict->roots_[i - 1].cp >= root.cp || dict->roots_[i - 1].last > root.first)))
+		{
+			throw opencc::InvalidFormat(file + " has a bad root table");
+		}
+
+		for (std::uint32_t k = root.first; k < root.last; k++)
+		{
+			unsigned cp;
+			if (FirstCharacter(dict->KeyData(k), dict->KeyLength(k), cp) == 0 || cp != root.cp)
+			{
+				throw opencc::InvalidFormat(file + " has a bad root table");
+			}
+		}
+	}
+
+	return dict;
+}
+
+void MappedDict::SerializeToFile(PrefixDict const &dict, std::string const &file)
+{
+	Header header;
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.byte_order = kByteOrder;
+	header.count = (std::uint32_t)dict.Size();
+	header.max_key_length = 0;
+
+	std::vector<std::uint32_t> key_offsets(1, 0);
+	std::vector<std::uint32_t> value_offsets(1, 0);
+	std::vector<Root> roots;
+	std::string key_pool;
+	std::string value_pool;
+	for (std::size_t i = 0; i < dict.Size(); i++)
+	{
+		std::string key = dict.Key(i);
+		unsigned cp;
+		std::size_t cp_length = FirstCharacter(key.data(), key.length(), cp);
+		if (cp_length == 0)
+		{
+			throw opencc::InvalidFormat("key doesn't start with a UTF-8 character: " + key);
+		}
+
+		// Keys are sorted by bytes, so those sharing a first character are
+		// adjacent and the roots come out ascending by codepoint.
+		if (roots.empty() || roots.back().cp != cp)
+		{
+			roots.push_back(Root{ cp, (std::uint32_t)i, (std::uint32_t)i });
+		}
+
+		roots.back().last = (std::uint32_t)i + 1;
+		header.max_key_length = std::max(header.max_key_length, (std::uint32_t)key.length());
+		key_pool += key;
+		EntryView entry = dict.Entry(i);
+		value_pool.append(entry.value, entry.value_length);
+		key_offsets.push_back((std::uint32_t)key_pool.length());
+		value_offsets.push_back((std::uint32_t)value_pool.length());
+	}
+
+	header.root_count = (std::uint32_t)roots.size();
+	header.key_pool_length = (std::uint32_t)key_pool.length();
+	header.value_pool_length = (std::uint32_t)value_pool.length();
+
+	std::ofstream ofs(file, std::ios::binary);
+	WritePadded(ofs, &header, sizeof(header));
+	WritePadded(ofs, key_offsets.data(), key_offsets.size() * sizeof(std::uint32_t));
+	WritePadded(ofs, value_offsets.data(), value_offsets.size() * sizeof(std::uint32_t));
+	WritePadded(ofs, roots.data(), roots.size() * sizeof(Root));
+	WritePadded(ofs, key_pool.data(), key_pool.length());
+	WritePadded(ofs, value_pool.data(), value_pool.length());
+	ofs.close();
+	if (!ofs)
+	{
+		throw opencc::FileNotWritable(file);
+	}
+}
+
+std::size_t MappedDict::Find(const char *text, std::size_t length, std::uint32_t &index) const
+{
+	unsigned cp;
+	std::size_t i = FirstCharacter(text, length, cp);
+	if (i == 0)
+	{
+		return 0;
+	}
+
+	Root const *roots_end = roots_ + header_->root_count;
+	Root const *root = std::lower_bound(roots_, roots_end, cp, [](Root const &r, unsigned key) {
+		return r.cp < key;
+	});
+	if (root == roots_end || root->cp != cp)
+	{
+		return 0;
+	}
+
+	return SearchPrefix(*this, text, std::min<std::size_t>(length, header_->max_key_length), root->first, root->last, i, index);
+}
+
+std::size_t MappedDict::MatchPrefix(const char *text, std::size_t length, EntryView &entry) const
+{
+	std::uint32_t index;
+	std::size_t matched = Find(text, length, index);
+	if (matched > 0)
+	{
+		entry = Entry(index);
+	}
+
+	return matched;
+}
+
+opencc::DictEntry const *MappedDict::CachedEntry(std::uint32_t index) const
+{
+	std::lock_guard<std::mutex> lock(entries_mutex_);
+	std::unique_ptr<opencc::DictEntry> &entry = entries_[index];
+	if (!entry)
+	{
+		EntryView view = Entry(index);
+		entry.reset(opencc::DictEntryFactory::New(std::string(view.key, view.key_length), std::string(view.value, view.value_length)));
+	}
+
+	return entry.get();
+}
+
+opencc::Optional<const opencc::DictEntry *> MappedDict::Match(const char *word, std::size_t len) const
+{
+	std::uint32_t index;
+	if (len == 0 || Find(word, len, index) != len)
+	{
+		return opencc::Optional<const opencc::DictEntry *>::Null();
+	}
+
+	return opencc::Optional<const opencc::DictEntry *>(CachedEntry(index));
+}
+
+opencc::Optional<const opencc::DictEntry *> MappedDict::MatchPrefix(const char *word, std::size_t len) const
+{
+	std::uint32_t index;
+	if (Find(word, len, index) == 0)
+	{
+		return opencc::Optional<const opencc::DictEntry *>::Null();
+	}
+
+	return opencc::Optional<const opencc::DictEntry *>(CachedEntry(index));
+}
+
+std::size_t MappedDict::KeyMaxLength() const
+{
+	return header_->max_key_length;
+}
+
+opencc::LexiconPtr MappedDict::GetLexicon() const
+{
+	opencc::LexiconPtr lexicon(new opencc::Lexicon());
+	for (std::uint32_t i = 0; i < header_->count; i++)
+	{
+		EntryView view = Entry(i);
+		lexicon->Add(opencc::DictEntryFactory::New(std::string(view.key, view.key_length), std::string(view.value, view.value_length)));
+	}
+
+	return lexicon;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencc/Dict.hpp>
+#include <opencc/DictEntry.hpp>
+#include "PrefixSearch.hpp"
+
+class PrefixDict;
+
+// A dictionary used straight from a memory mapping of its file, with no
+// parsing on load, so every process converting with it shares one copy in
+// the page cache. The file (.ccd) holds, in native byte order and each
+// section 4-byte aligned:
+//
+//   Header
+//   uint32 key_offsets[count + 1]     into the key pool, keys sorted by byte
+//   uint32 value_offsets[count + 1]   into the value pool
+//   Root roots[root_count]            by first codepoint, ascending
+//   key pool, value pool
+//
+// It is PrefixDict's layout: a root gives the entries whose keys start with
+// one character, so matching starts there and narrows a byte at a time.
+class MappedDict : public opencc::Dict
+{
+public:
+	// Throws opencc::FileNotFound or opencc::InvalidFormat.
+	static std::shared_ptr<MappedDict> NewFromFile(std::string const &file);
+
+	// Writes each entry's default value only. Throws
+	// opencc::FileNotWritable, or opencc::InvalidFormat for a key that
+	// doesn't start with a well-formed character.
+	static void SerializeToFile(PrefixDict const &dict, std::string const &file);
+
+	~MappedDict();
+
+	MappedDict(MappedDict const &) = delete;
+	MappedDict &operator=(MappedDict const &) = delete;
+
+	// Returns the length of the longest key that the first length bytes of
+	// text start with, and points entry into the mapping; 0 if no key
+	// matches.
+	std::size_t MatchPrefix(const char *text, std::size_t length, EntryView &entry) const;
+
+	std::size_t Size() const
+	{
+		return header_->count;
+	}
+
+	EntryView Entry(std::size_t i) const
+	{
+		return EntryView{ KeyData(i), KeyLength(i), value_pool_ + value_offsets_[i], value_offsets_[i + 1] - value_offsets_[i], 1 };
+	}
+
+	const char *KeyData(std::size_t i) const
+	{
+		return key_pool_ + key_offsets_[i];
+	}
+
+	std::size_t KeyLength(std::size_t i) const
+	{
+		return key_offsets_[i + 1] - key_offsets_[i];
+	}
+
+	// opencc::Dict, for use in an opencc::Converter. It hands out DictEntry
+	// objects, which are made on first use and kept.
+	using opencc::Dict::Match;
+	using opencc::Dict::MatchPrefix;
+	virtual opencc::Optional<const opencc::DictEntry *> Match(const char *word, std::size_t len) const;
+	virtual opencc::Optional<const opencc::DictEntry *> MatchPrefix(const char *word, std::size_t len) const;
+	virtual std::size_t KeyMaxLength() const;
+	// A copy of every entry.
+	virtual opencc::LexiconPtr GetLexicon() const;
+
+	struct Header
+	{
+		char magic[8];
+		std::uint32_t byte_order;
+		std::uint32_t count;
+		std::uint32_t root_count;
+		std::uint32_t max_key_length;
+		std::uint32_t key_pool_length;
+		std::uint32_t value_pool_length;
+	};
+
+	struct Root
+	{
+		std::uint32_t cp;
+		std::uint32_t first;
+		std::uint32_t last;
+	};
+
+private:
+	MappedDict();
+
+	// The entry with the longest key text starts with; 0 if there is none.
+	std::size_t Find(const char *text, std::size_t length, std::uint32_t &index) const;
+	opencc::DictEntry const *CachedEntry(std::uint32_t index) const;
+
+	void *mapping_;
+	std::size_t mapping_length_;
+	// Where mapping isn't available the file is read into memory instead.
+	std::vector<char> copy_;
+
+	Header const *header_;
+	std::uint32_t const *key_offsets_;
+	std::uint32_t const *value_offsets_;
+	Root const *roots_;
+	const char *key_pool_;
+	const char *value_pool_;
+
+	mutable std::mutex entries_mutex_;
+	mutable std::unordered_map<std::uint32_t, std::unique_ptr<opencc::DictEntry>> entries_;
+};
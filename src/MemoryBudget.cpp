@@ -0,0 +1,54 @@
+#include "MemoryBudget.hpp"
+
+MemoryBudget::MemoryBudget(std::uint64_t limit) : limit_(limit), used_(0), high_water_(0)
+{
+}
+
+void MemoryBudget::Acquire(std::uint64_t bytes)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	released_.wait(lock, [this, bytes] { return Fits(bytes); });
+	Take(bytes);
+}
+
+bool MemoryBudget::TryAcquire(std::uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!Fits(bytes))
+	{
+		return false;
+	}
+
+	Take(bytes);
+	return true;
+}
+
+void MemoryBudget::Release(std::uint64_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		used_ -= bytes;
+	}
+
+	released_.notify_all();
+}
+
+std::uint64_t MemoryBudget::HighWater()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return high_water_;
+}
+
+bool MemoryBudget::Fits(std::uint64_t bytes) const
+{
+	return limit_ == 0 || used_ == 0 || used_ + bytes <= limit_;
+}
+
+void MemoryBudget::Take(std::uint64_t bytes)
+{
+	used_ += bytes;
+	if (used_ > high_water_)
+	{
+		high_water_ = used_;
+	}
+}
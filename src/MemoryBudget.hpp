@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Caps the bytes held by files in flight across every thread. Work reserves
+// its estimated footprint before reading and waits while the budget is spent.
+// A reservation bigger than the whole budget is let through once nothing else
+// is held, so an oversized file runs alone instead of never.
+class MemoryBudget
+{
+public:
+	// 0 means no limit; the high-water mark is tracked either way.
+	explicit MemoryBudget(std::uint64_t limit);
+
+	MemoryBudget(MemoryBudget const &) = delete;
+	MemoryBudget &operator=(MemoryBudget const &) = delete;
+
+	void Acquire(std::uint64_t bytes);
+
+	// Takes the bytes only if that needs no waiting.
+	bool TryAcquire(std::uint64_t bytes);
+
+	void Release(std::uint64_t bytes);
+
+	std::uint64_t Limit() const
+	{
+		return limit_;
+	}
+
+	std::uint64_t HighWater();
+
+private:
+	bool Fits(std::uint64_t bytes) const;
+	void Take(std::uint64_t bytes);
+
+	std::uint64_t limit_;
+	std::uint64_t used_;
+	std::uint64_t high_water_;
+	std::mutex mutex_;
+	std::condition_variable released_;
+};
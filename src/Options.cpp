@@ -0,0 +1,98 @@
+#include "Options.hpp"
+#include <cctype>
+#include <stdexcept>
+#include <yaml-cpp/yaml.h>
+
+std::uint64_t ParseSize(std::string const &text)
+{
+	std::size_t pos = 0;
+	std::uint64_t value = 0;
+	while (pos < text.length() && isdigit((unsigned char)text[pos]))
+	{
+		value = value * 10 + (text[pos] - '0');
+		pos++;
+	}
+
+	if (pos == 0)
+	{
+		throw std::runtime_error("invalid size: " + text);
+	}
+
+	std::string suffix = text.substr(pos);
+	if (suffix == "K" || suffix == "k")
+	{
+		value <<= 10;
+	}
+	else if (suffix == "M" || suffix == "m")
+	{
+		value <<= 20;
+	}
+	else if (suffix == "G" || suffix == "g")
+	{
+		value <<= 30;
+	}
+	else if (!suffix.empty())
+	{
+		throw std::runtime_error("invalid size: " + text);
+	}
+
+	return value;
+}
+
+static std::vector<std::string> GetList(YAML::Node const &node)
+{
+	if (!node)
+	{
+		return std::vector<std::string>();
+	}
+
+	return node.as<std::vector<std::string>>();
+}
+
+void LoadOptions(std::string const &config_file, Options &options)
+{
+	YAML::Node config = YAML::LoadFile(config_file);
+	YAML::Node cc = config["cc"];
+	options.input_directory = cc["input_directory"].as<std::string>();
+	options.output_directory = cc["output_directory"].as<std::string>();
+	options.exclude_extension = GetList(cc["exclude_extension"]);
+	options.exclude_path = GetList(cc["exclude_path"]);
+	options.include_path = GetList(cc["include_path"]);
+	options.max_file_size = ParseSize(cc["max_file_size"].as<std::string>("0"));
+	options.profile = cc["profile"].as<std::string>("s2t.json");
+	options.engine = cc["engine"].as<std::string>("fused");
+	if (options.engine != "fused" && options.engine != "opencc")
+	{
+		throw std::runtime_error("invalid engine: " + options.engine);
+	}
+	options.keep_utf16 = cc["keep_utf16"].as<bool>(false);
+	options.io_threads = cc["io_threads"].as<std::size_t>(2);
+	options.convert_threads = cc["convert_threads"].as<std::size_t>(0);
+	options.schedule = cc["schedule"].as<std::string>("scan");
+	if (options.schedule != "scan" && options.schedule != "largest_first")
+	{
+		throw std::runtime_error("invalid schedule: " + options.schedule);
+	}
+
+	options.small_file_size = ParseSize(cc["small_file_size"].as<std::string>("64K"));
+	options.large_file_size = ParseSize(cc["large_file_size"].as<std::string>("64M"));
+	options.max_inflight_bytes = ParseSize(cc["max_inflight_bytes"].as<std::string>("1G"));
+	options.walk_threads = cc["walk_threads"].as<std::size_t>(4);
+	options.io_backend = cc["io_backend"].as<std::string>("posix");
+	if (options.io_backend != "posix" && options.io_backend != "io_uring")
+	{
+		throw std::runtime_error("invalid io_backend: " + options.io_backend);
+	}
+
+	options.output_mode = cc["output_mode"].as<std::string>("write");
+	if (options.output_mode != "write" && options.output_mode != "mmap")
+	{
+		throw std::runtime_error("invalid output_mode: " + options.output_mode);
+	}
+
+	options.durability = cc["durability"].as<std::string>("none");
+	if (options.durability != "none" && options.durability != "syncfs" && options.durability != "fsync")
+	{
+		throw std::runtime_error("invalid durability: " + options.durability);
+	}
+}
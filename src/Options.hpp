@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Everything read from config.yaml.
+struct Options
+{
+	std::string input_directory;
+	std::string output_directory;
+	std::vector<std::string> exclude_extension;
+	std::vector<std::string> exclude_path;
+	std::vector<std::string> include_path;
+	// 0 means no limit.
+	std::uint64_t max_file_size;
+	std::string profile;
+	// "fused" or "opencc"; see Profile::Load.
+	std::string engine;
+	bool keep_utf16;
+	// Threads copying excluded files alongside conversion.
+	std::size_t io_threads;
+	// Threads converting files, 0 for one per core.
+	std::size_t convert_threads;
+	// "scan" converts files in the order found, "largest_first" sorts them
+	// by size once the walk is over.
+	std::string schedule;
+	// Files below this are converted in batches.
+	std::uint64_t small_file_size;
+	// Files from this size up are streamed in chunks; 0 never does.
+	std::uint64_t large_file_size;
+	// Bytes that files being converted may hold at once; 0 means no limit.
+	std::uint64_t max_inflight_bytes;
+	// Threads reading directories.
+	std::size_t walk_threads;
+	// "posix" or "io_uring".
+	std::string io_backend;
+	// How files converted whole, from small_file_size up, are written:
+	// "write" from the converted text, or "mmap" converted into the file.
+	std::string output_mode;
+	// "none", "syncfs" or "fsync"; see Durability.
+	std::string durability;
+};
+
+// Throws YAML::Exception for a missing or malformed file, std::runtime_error
+// for an invalid value.
+void LoadOptions(std::string const &config_file, Options &options);
+
+// Parses a byte count with an optional K, M or G suffix (powers of 1024).
+std::uint64_t ParseSize(std::string const &text);
@@ -0,0 +1,226 @@
+#include "OutputFile.hpp"
+#include <cerrno>
+
+#ifndef _WIN32
+#include <climits>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef _WIN32
+OutputFile::OutputFile()
+{
+}
+
+OutputFile::~OutputFile()
+{
+}
+
+int OutputFile::Open(FileLocation const &location, std::uint64_t expected_length)
+{
+	ofs_.open(location.path, std::ios::binary);
+	return ofs_.is_open() ? 0 : EACCES;
+}
+
+int OutputFile::Write(std::vector<OutputBuffer> const &buffers)
+{
+	for (OutputBuffer const &buffer : buffers)
+	{
+		ofs_.write(buffer.data, buffer.length);
+	}
+
+	return ofs_.fail() ? EIO : 0;
+}
+
+int OutputFile::Close()
+{
+	ofs_.close();
+	return ofs_.fail() ? EIO : 0;
+}
+#else
+OutputFile::OutputFile() : fd_(-1), offset_(0)
+{
+}
+
+OutputFile::~OutputFile()
+{
+	if (fd_ >= 0)
+	{
+		close(fd_);
+	}
+}
+
+int OutputFile::Open(FileLocation const &location, std::uint64_t expected_length)
+{
+	fd_ = openat(AtFd(location), AtName(location), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd_ < 0)
+	{
+		return errno;
+	}
+
+#ifdef __linux__
+	// One extent reserved up front, rather than grown a write at a time.
+	// Filesystems without fallocate just skip it.
+	if (expected_length > 0)
+	{
+		fallocate(fd_, 0, 0, (off_t)expected_length);
+	}
+#endif
+
+	return 0;
+}
+
+int OutputFile::Write(std::vector<OutputBuffer> const &buffers)
+{
+	std::vector<struct iovec> iov;
+	for (OutputBuffer const &buffer : buffers)
+	{
+		if (buffer.length > 0)
+		{
+			struct iovec item;
+			item.iov_base = (void *)buffer.data;
+			item.iov_len = buffer.length;
+			iov.push_back(item);
+		}
+	}
+
+	// pwritev takes at most IOV_MAX buffers, and may stop short of the end.
+	std::size_t first = 0;
+	while (first < iov.size())
+	{
+		int count = (int)(iov.size() - first < IOV_MAX ? iov.size() - first : IOV_MAX);
+		ssize_t ret = pwritev(fd_, &iov[first], count, (off_t)offset_);
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (ret < 0)
+		{
+			return errno;
+		}
+
+		offset_ += ret;
+		std::size_t left = (std::size_t)ret;
+		while (first < iov.size() && left >= iov[first].iov_len)
+		{
+			left -= iov[first].iov_len;
+			first++;
+		}
+
+		if (first < iov.size())
+		{
+			iov[first].iov_base = (char *)iov[first].iov_base + left;
+			iov[first].iov_len -= left;
+		}
+	}
+
+	return 0;
+}
+
+int OutputFile::Close()
+{
+	int error = 0;
+	// Drops whatever the preallocation reserved beyond the real output.
+	if (ftruncate(fd_, (off_t)offset_) != 0)
+	{
+		error = errno;
+	}
+
+	if (close(fd_) != 0 && error == 0)
+	{
+		error = errno;
+	}
+
+	fd_ = -1;
+	return error;
+}
+#endif
+
+MappedOutputFile::MappedOutputFile() : fd_(-1), data_(nullptr), capacity_(0)
+{
+}
+
+#ifdef __linux__
+MappedOutputFile::~MappedOutputFile()
+{
+	if (data_ != nullptr)
+	{
+		munmap(data_, capacity_);
+	}
+
+	if (fd_ >= 0)
+	{
+		close(fd_);
+	}
+}
+
+int MappedOutputFile::Open(FileLocation const &location, std::size_t capacity)
+{
+	if (capacity == 0)
+	{
+		return EINVAL;
+	}
+
+	fd_ = openat(AtFd(location), AtName(location), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd_ < 0)
+	{
+		return errno;
+	}
+
+	// Without the blocks behind it, a store into a sparse mapping on a full
+	// disk would raise SIGBUS instead of returning an error.
+	if (fallocate(fd_, 0, 0, (off_t)capacity) != 0)
+	{
+		return errno;
+	}
+
+	void *data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (data == MAP_FAILED)
+	{
+		return errno;
+	}
+
+	data_ = (char *)data;
+	capacity_ = capacity;
+	return 0;
+}
+
+int MappedOutputFile::Close(std::size_t length)
+{
+	int error = 0;
+	if (munmap(data_, capacity_) != 0)
+	{
+		error = errno;
+	}
+
+	data_ = nullptr;
+	// Drops the blocks reserved beyond the real output.
+	if (ftruncate(fd_, (off_t)length) != 0 && error == 0)
+	{
+		error = errno;
+	}
+
+	if (close(fd_) != 0 && error == 0)
+	{
+		error = errno;
+	}
+
+	fd_ = -1;
+	return error;
+}
+#else
+MappedOutputFile::~MappedOutputFile()
+{
+}
+
+int MappedOutputFile::Open(FileLocation const &, std::size_t)
+{
+	return ENOSYS;
+}
+
+int MappedOutputFile::Close(std::size_t)
+{
+	return ENOSYS;
+}
+#endif
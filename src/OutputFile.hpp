@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "FileLocation.hpp"
+
+struct OutputBuffer
+{
+	const char *data;
+	std::size_t length;
+};
+
+// A file written front to back as a run of buffers. Each run goes out as one
+// pwritev. On Linux blocks for the expected length are reserved up front and
+// Close trims the file to what was actually written. Windows gets an
+// ofstream.
+class OutputFile
+{
+public:
+	OutputFile();
+	~OutputFile();
+
+	OutputFile(OutputFile const &) = delete;
+	OutputFile &operator=(OutputFile const &) = delete;
+
+	// Returns 0, or an errno value.
+	int Open(FileLocation const &location, std::uint64_t expected_length);
+
+	int Write(std::vector<OutputBuffer> const &buffers);
+
+	int Close();
+
+private:
+#ifdef _WIN32
+	fs::ofstream ofs_;
+#else
+	int fd_;
+	std::uint64_t offset_;
+#endif
+};
+
+// A file written through a shared mapping, for output that is converted
+// straight into it. Open maps the most the output could take and Close trims
+// the file to what was filled in. The blocks are reserved up front, so a full
+// disk fails Open rather than a store into the mapping. Linux only; elsewhere
+// Open fails with ENOSYS.
+class MappedOutputFile
+{
+public:
+	MappedOutputFile();
+	~MappedOutputFile();
+
+	MappedOutputFile(MappedOutputFile const &) = delete;
+	MappedOutputFile &operator=(MappedOutputFile const &) = delete;
+
+	// Returns 0, or an errno value.
+	int Open(FileLocation const &location, std::size_t capacity);
+
+	char *Data() const
+	{
+		return data_;
+	}
+
+	int Close(std::size_t length);
+
+private:
+	int fd_;
+	char *data_;
+	std::size_t capacity_;
+};
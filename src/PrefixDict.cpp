@@ -0,0 +1,237 @@
+#include "PrefixDict.hpp"
+#include <algorithm>
+#include <cstring>
+#include <opencc/DictEntry.hpp>
+#include "Utf8.hpp"
+
+PrefixDict::PrefixDict(opencc::Lexicon const &lexicon) : key_offsets_(1, 0), value_offsets_(1, 0), alternate_index_(1, 0), alternate_offsets_(1, 0), max_key_length_(0), single_character_(false)
+{
+	key_offsets_.reserve(lexicon.Length() + 1);
+	value_offsets_.reserve(lexicon.Length() + 1);
+	alternate_index_.reserve(lexicon.Length() + 1);
+	for (auto const &entry : lexicon)
+	{
+		std::string key = entry->Key();
+		std::string value = entry->GetDefault();
+		if (Add(key.data(), key.length(), value.data(), value.length()) && entry->NumValues() > 1)
+		{
+			std::vector<std::string> values = entry->Values();
+			for (std::size_t k = 1; k < values.size(); k++)
+			{
+				AddAlternate(values[k].data(), values[k].length());
+			}
+		}
+	}
+
+	Sort();
+}
+
+PrefixDict::PrefixDict(std::vector<std::pair<std::string, std::string>> const &entries) : key_offsets_(1, 0), value_offsets_(1, 0), alternate_index_(1, 0), alternate_offsets_(1, 0), max_key_length_(0), single_character_(false)
+{
+	key_offsets_.reserve(entries.size() + 1);
+	value_offsets_.reserve(entries.size() + 1);
+	for (auto const &entry : entries)
+	{
+		Add(entry.first.data(), entry.first.length(), entry.second.data(), entry.second.length());
+	}
+
+	Sort();
+}
+
+bool PrefixDict::Add(const char *key, std::size_t key_length, const char *value, std::size_t value_length)
+{
+	// An empty key would match everywhere without moving on.
+	if (key_length == 0)
+	{
+		return false;
+	}
+
+	max_key_length_ = std::max(max_key_length_, key_length);
+	key_pool_.append(key, key_length);
+	value_pool_.append(value, value_length);
+	key_offsets_.push_back((std::uint32_t)key_pool_.length());
+	value_offsets_.push_back((std::uint32_t)value_pool_.length());
+	alternate_index_.push_back(alternate_index_.back());
+	return true;
+}
+
+void PrefixDict::AddAlternate(const char *value, std::size_t value_length)
+{
+	alternate_pool_.append(value, value_length);
+	alternate_offsets_.push_back((std::uint32_t)alternate_pool_.length());
+	alternate_index_.back()++;
+}
+
+EntryView PrefixDict::Entry(std::size_t i, std::size_t k) const
+{
+	EntryView entry = Entry(i);
+	if (k > 0)
+	{
+		std::size_t alternate = alternate_index_[i] + k - 1;
+		entry.value = alternate_pool_.data() + alternate_offsets_[alternate];
+		entry.value_length = alternate_offsets_[alternate + 1] - alternate_offsets_[alternate];
+	}
+
+	return entry;
+}
+
+void PrefixDict::Sort()
+{
+	// Keys compare as unsigned bytes, the order the byte-wise narrowing
+	// relies on; of equal keys the first added is kept.
+	std::vector<std::uint32_t> order(Size());
+	for (std::size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = (std::uint32_t)i;
+	}
+
+	auto compare = [this](std::uint32_t a, std::uint32_t b) {
+		std::size_t a_length = KeyLength(a);
+		std::size_t b_length = KeyLength(b);
+		int c = memcmp(KeyData(a), KeyData(b), std::min(a_length, b_length));
+		return c != 0 ? c : (a_length < b_length ? -1 : (a_length > b_length ? 1 : 0));
+	};
+	std::stable_sort(order.begin(), order.end(), [&compare](std::uint32_t a, std::uint32_t b) {
+		return compare(a, b) < 0;
+	});
+	order.erase(std::unique(order.begin(), order.end(), [&compare](std::uint32_t a, std::uint32_t b) {
+		return compare(a, b) == 0;
+	}), order.end());
+
+	std::string key_pool;
+	std::string value_pool;
+	std::string alternate_pool;
+	std::vector<std::uint32_t> key_offsets(1, 0);
+	std::vector<std::uint32_t> value_offsets(1, 0);
+	std::vector<std::uint32_t> alternate_index(1, 0);
+	std::vector<std::uint32_t> alternate_offsets(1, 0);
+	key_pool.reserve(key_pool_.length());
+	value_pool.reserve(value_pool_.length());
+	alternate_pool.reserve(alternate_pool_.length());
+	key_offsets.reserve(order.size() + 1);
+	value_offsets.reserve(order.size() + 1);
+	alternate_index.reserve(order.size() + 1);
+	alternate_offsets.reserve(alternate_offsets_.size());
+	for (std::uint32_t i : order)
+	{
+		EntryView entry = Entry(i);
+		key_pool.append(entry.key, entry.key_length);
+		value_pool.append(entry.value, entry.value_length);
+		key_offsets.push_back((std::uint32_t)key_pool.length());
+		value_offsets.push_back((std::uint32_t)value_pool.length());
+		for (std::size_t k = 1; k < entry.value_count; k++)
+		{
+			EntryView alternate = Entry(i, k);
+			alternate_pool.append(alternate.value, alternate.value_length);
+			alternate_offsets.push_back((std::uint32_t)alternate_pool.length());
+		}
+
+		alternate_index.push_back((std::uint32_t)alternate_offsets.size() - 1);
+	}
+
+	key_pool_.swap(key_pool);
+	value_pool_.swap(value_pool);
+	key_offsets_.swap(key_offsets);
+	value_offsets_.swap(value_offsets);
+	if (alternate_offsets.size() > 1)
+	{
+		alternate_pool_.swap(alternate_pool);
+		alternate_index_.swap(alternate_index);
+		alternate_offsets_.swap(alternate_offsets);
+	}
+	else
+	{
+		std::string().swap(alternate_pool_);
+		std::vector<std::uint32_t>().swap(alternate_index_);
+		std::vector<std::uint32_t>().swap(alternate_offsets_);
+	}
+
+	// Keys starting with the same character are adjacent, since the
+	// character's bytes are a prefix of each.
+	std::vector<std::uint32_t> root_cps;
+	bool single_character = true;
+	for (std::size_t i = 0; i < Size(); i++)
+	{
+		const char *key = KeyData(i);
+		std::size_t key_length = KeyLength(i);
+		unsigned cp;
+		std::size_t length = ReadUtf8((const unsigned char *)key, key_length, cp);
+		if (length == 1 && (unsigned char)key[0] >= 0x80)
+		{
+			root_ranges_.clear();
+			return;
+		}
+
+		single_character = single_character && length == key_length;
+		std::uint32_t root_first = root_ranges_.empty() ? 0 : root_ranges_.back().first;
+		if (root_ranges_.empty() || KeyLength(root_first) < length || memcmp(key, KeyData(root_first), length) != 0)
+		{
+			root_cps.push_back(cp);
+			root_ranges_.push_back(std::make_pair((std::uint32_t)i, (std::uint32_t)i));
+		}
+
+		root_ranges_.back().second = (std::uint32_t)i + 1;
+	}
+
+	// Keys sort by codepoint too, so the sorted part of the table fills in
+	// order.
+	roots_.reset(new CodepointTable(CodepointTable::DenseFor(root_cps)));
+	for (std::size_t i = 0; i < root_cps.size(); i++)
+	{
+		roots_->Insert(root_cps[i], (std::uint32_t)i);
+	}
+
+	single_character_ = single_character;
+}
+
+std::size_t PrefixDict::MatchPrefix(const char *text, std::size_t length, EntryView &entry) const
+{
+	std::uint32_t lo = 0;
+	std::uint32_t hi = (std::uint32_t)Size();
+	std::size_t i = 0;
+	if (roots_)
+	{
+		if (length == 0)
+		{
+			return 0;
+		}
+
+		// Every key starts with a well-formed character, so nothing matches
+		// at a malformed one.
+		unsigned cp;
+		i = ReadUtf8((const unsigned char *)text, length, cp);
+		std::uint32_t root = i == 1 && (unsigned char)text[0] >= 0x80 ? CodepointTable::kNone : roots_->Find(cp);
+		if (root == CodepointTable::kNone)
+		{
+			return 0;
+		}
+
+		lo = root_ranges_[root].first;
+		hi = root_ranges_[root].second;
+	}
+
+	std::uint32_t index;
+	std::size_t matched = SearchPrefix(*this, text, std::min(length, max_key_length_), lo, hi, i, index);
+	if (matched > 0)
+	{
+		entry = Entry(index);
+	}
+
+	return matched;
+}
+
+std::size_t PrefixDict::MemoryUsage() const
+{
+	return key_pool_.capacity() + value_pool_.capacity() + alternate_pool_.capacity()
+		+ (key_offsets_.capacity() + value_offsets_.capacity() + alternate_index_.capacity() + alternate_offsets_.capacity()) * sizeof(std::uint32_t)
+		+ root_ranges_.capacity() * sizeof(root_ranges_[0])
+		+ (roots_ ? roots_->MemoryUsage() : 0);
+}
+
+bool PrefixDict::operator==(PrefixDict const &other) const
+{
+	return key_offsets_ == other.key_offsets_ && value_offsets_ == other.value_offsets_
+		&& key_pool_ == other.key_pool_ && value_pool_ == other.value_pool_
+		&& alternate_index_ == other.alternate_index_ && alternate_offsets_ == other.alternate_offsets_
+		&& alternate_pool_ == other.alternate_pool_;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <opencc/Lexicon.hpp>
+#include "CodepointTable.hpp"
+#include "PrefixSearch.hpp"
+
+// A dictionary's keys in sorted order, matched against text a byte at a time
+// by narrowing the range of keys that share the bytes seen so far. Matching
+// is on bytes, as OpenCC's ocd2 dictionaries do. The first character is
+// not narrowed byte by byte but looked up by codepoint, which gives the keys
+// starting with it in one step; for a dictionary of single characters, such
+// as STCharacters, that is the whole match.
+//
+// Keys and values lie back to back in one pool each, found through arrays
+// of offsets, rather than in a string (or a DictEntry) per entry. Lookups
+// hand out views into the pools and never allocate.
+class PrefixDict
+{
+public:
+	explicit PrefixDict(opencc::Lexicon const &lexicon);
+
+	// Of the entries with the same key, the first is kept.
+	explicit PrefixDict(std::vector<std::pair<std::string, std::string>> const &entries);
+
+	// Returns the length of the longest key that the first length bytes of
+	// text start with, and sets entry to it; 0 if no key matches.
+	std::size_t MatchPrefix(const char *text, std::size_t length, EntryView &entry) const;
+
+	// Same keys and values.
+	bool operator==(PrefixDict const &other) const;
+
+	// True if no key is longer than one character, so that matching never
+	// looks past the character at hand.
+	bool SingleCharacterKeys() const
+	{
+		return single_character_;
+	}
+
+	// Bytes held: pools, offsets and root table.
+	std::size_t MemoryUsage() const;
+
+	// Entries in key order.
+	std::size_t Size() const
+	{
+		return key_offsets_.size() - 1;
+	}
+
+	EntryView Entry(std::size_t i) const
+	{
+		return EntryView{ KeyData(i), KeyLength(i), value_pool_.data() + value_offsets_[i], value_offsets_[i + 1] - value_offsets_[i], ValueCount(i) };
+	}
+
+	// Entry i with its value k in place of the default; k < value_count.
+	EntryView Entry(std::size_t i, std::size_t k) const;
+
+	// An entry without values of its own has its key as its one value.
+	std::size_t ValueCount(std::size_t i) const
+	{
+		return alternate_index_.empty() ? 1 : 1 + alternate_index_[i + 1] - alternate_index_[i];
+	}
+
+	const char *KeyData(std::size_t i) const
+	{
+		return key_pool_.data() + key_offsets_[i];
+	}
+
+	std::size_t KeyLength(std::size_t i) const
+	{
+		return key_offsets_[i + 1] - key_offsets_[i];
+	}
+
+	// Copies, for building other dictionaries.
+	std::string Key(std::size_t i) const
+	{
+		return std::string(KeyData(i), KeyLength(i));
+	}
+
+	std::string Value(std::size_t i) const
+	{
+		EntryView entry = Entry(i);
+		return std::string(entry.value, entry.value_length);
+	}
+
+private:
+	// Returns false for an entry that isn't added.
+	bool Add(const char *key, std::size_t key_length, const char *value, std::size_t value_length);
+	// Another value for the entry added last.
+	void AddAlternate(const char *value, std::size_t value_length);
+	void Sort();
+
+	// Entry i's key is key_pool_[key_offsets_[i], key_offsets_[i + 1]), and
+	// its value likewise.
+	std::string key_pool_;
+	std::string value_pool_;
+	std::vector<std::uint32_t> key_offsets_;
+	std::vector<std::uint32_t> value_offsets_;
+	// Values past the default: entry i's are alternate_index_[i] up to
+	// alternate_index_[i + 1], each at alternate_offsets_ into
+	// alternate_pool_. All empty if no entry has more than one value.
+	std::vector<std::uint32_t> alternate_index_;
+	std::vector<std::uint32_t> alternate_offsets_;
+	std::string alternate_pool_;
+	std::size_t max_key_length_;
+	bool single_character_;
+	// By first codepoint, an index into root_ranges_, which holds the range
+	// of entries whose keys start with it. Only built if every key starts
+	// with a well-formed character.
+	std::unique_ptr<CodepointTable> roots_;
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> root_ranges_;
+};
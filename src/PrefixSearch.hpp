@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// An entry's key and value, pointing into the dictionary that holds them.
+// Looking one up copies nothing. value is the entry's first, default value
+// of value_count.
+struct EntryView
+{
+	const char *key;
+	std::size_t key_length;
+	const char *value;
+	std::size_t value_length;
+	std::size_t value_count;
+};
+
+// Longest-prefix search over keys sorted by byte, for dictionaries with
+// KeyData(i) and KeyLength(i). Every key in [lo, hi) starts with the first i
+// bytes of text. The one that is exactly that long, if any, sorts first;
+// past it the rest are ordered by their byte at i, so each byte narrows the
+// range with two binary searches. Returns the length of the longest key
+// within limit bytes and sets index to it; 0 if none matches.
+template <typename Dict>
+std::size_t SearchPrefix(Dict const &dict, const char *text, std::size_t limit, std::uint32_t lo, std::uint32_t hi, std::size_t i, std::uint32_t &index)
+{
+	std::size_t matched = 0;
+	if (lo < hi && dict.KeyLength(lo) == i && i > 0)
+	{
+		matched = i;
+		index = lo;
+	}
+
+	for (; i < limit && lo < hi; i++)
+	{
+		if (dict.KeyLength(lo) == i)
+		{
+			lo++;
+		}
+
+		unsigned char c = (unsigned char)text[i];
+		std::uint32_t first = lo;
+		std::uint32_t count = hi - lo;
+		while (count > 0)
+		{
+			std::uint32_t step = count / 2;
+			if ((unsigned char)dict.KeyData(first + step)[i] < c)
+			{
+				first += step + 1;
+				count -= step + 1;
+			}
+			else
+			{
+				count = step;
+			}
+		}
+
+		std::uint32_t last = first;
+		count = hi - first;
+		while (count > 0)
+		{
+			std::uint32_t step = count / 2;
+			if ((unsigned char)dict.KeyData(last + step)[i] <= c)
+			{
+				last += step + 1;
+				count -= step + 1;
+			}
+			else
+			{
+				count = step;
+			}
+		}
+
+		lo = first;
+		hi = last;
+		if (lo < hi && dict.KeyLength(lo) == i + 1)
+		{
+			matched = i + 1;
+			index = lo;
+		}
+	}
+
+	return matched;
+}
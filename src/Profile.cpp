@@ -0,0 +1,176 @@
+#include "Profile.hpp"
+#include <cstring>
+#include <list>
+#include <vector>
+#include <opencc/Config.hpp>
+#include <opencc/Conversion.hpp>
+#include <opencc/ConversionChain.hpp>
+#include <opencc/Converter.hpp>
+#include <opencc/Dict.hpp>
+#include <opencc/Lexicon.hpp>
+#include <opencc/MaxMatchSegmentation.hpp>
+#include "TextScan.hpp"
+#include "Utf8.hpp"
+
+namespace
+{
+bool EndsWith(std::string const &s, std::string const &suffix)
+{
+	return s.length() >= suffix.length() && s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+}
+
+void Profile::Load(std::string const &config_file, std::string const &engine)
+{
+	// A .ccd is one dictionary used for both segmentation and conversion,
+	// as compose_profile writes it; the engine uses it straight from its
+	// mapping, and OpenCC through a converter built around it.
+	std::vector<opencc::DictPtr> dicts;
+	if (EndsWith(config_file, ".ccd"))
+	{
+		mapped_ = MappedDict::NewFromFile(config_file);
+		fused_ = engine == "fused";
+		if (fused_)
+		{
+			engine_.Load(*mapped_);
+		}
+		else
+		{
+			std::list<opencc::ConversionPtr> conversions{ opencc::ConversionPtr(new opencc::Conversion(mapped_)) };
+			converter_.reset(new opencc::Converter(config_file, opencc::SegmentationPtr(new opencc::MaxMatchSegmentation(mapped_)), opencc::ConversionChainPtr(new opencc::ConversionChain(conversions))));
+		}
+	}
+	else
+	{
+		opencc::Config config;
+		converter_ = config.NewFromFile(config_file);
+		fused_ = engine == "fused" && engine_.Load(*converter_);
+		for (opencc::ConversionPtr const &conversion : converter_->GetConversionChain()->GetConversions())
+		{
+			dicts.push_back(conversion->GetDict());
+		}
+	}
+
+	// Segmentation alone never changes text, and every conversion emits the
+	// value of the longest key matching at each position. Keys that map to
+	// themselves (common in STCharacters and STPhrases) emit the text as is,
+	// so only keys with a different value can change anything, and they can
+	// only match a text containing every one of their characters. One
+	// character per such key is enough: single characters stand for
+	// themselves, and a phrase is covered as soon as any of its characters is.
+	// Covering phrases by a character that is already in the set keeps
+	// phrases like 中签 from dragging in common characters like 中, which
+	// would stop already-Traditional text from being skipped.
+	//
+	// Text a key doesn't match is copied through, so a conversion grows text
+	// by at most the largest value-to-key length ratio among its entries, and
+	// a chain by the product of those.
+	key_chars_ = CodepointSet();
+	max_expansion_ = 1.0;
+	std::vector<std::string> phrases;
+	if (mapped_)
+	{
+		// Read from the mapping rather than through a lexicon, which would
+		// copy every entry.
+		for (std::size_t i = 0; i < mapped_->Size(); i++)
+		{
+			EntryView entry = mapped_->Entry(i);
+			AddKey(entry.key, entry.key_length, entry.value, entry.value_length, max_expansion_, phrases);
+		}
+	}
+
+	for (opencc::DictPtr const &dict : dicts)
+	{
+		opencc::LexiconPtr lexicon = dict->GetLexicon();
+		double expansion = 1.0;
+		for (auto const &entry : *lexicon)
+		{
+			std::string key = entry->Key();
+			std::string value = entry->GetDefault();
+			AddKey(key.data(), key.length(), value.data(), value.length(), expansion, phrases);
+		}
+
+		max_expansion_ *= expansion;
+	}
+
+	for (std::string const &phrase : phrases)
+	{
+		const unsigned char *p = (const unsigned char *)phrase.data();
+		const unsigned char *end = p + phrase.length();
+		unsigned first;
+		ReadUtf8(p, end - p, first);
+
+		bool covered = false;
+		while (p < end && !covered)
+		{
+			unsigned cp;
+			p += ReadUtf8(p, end - p, cp);
+			covered = key_chars_.Contains(cp);
+		}
+
+		if (!covered)
+		{
+			key_chars_.Insert(first);
+		}
+	}
+}
+
+void Profile::AddKey(const char *key, std::size_t key_length, const char *value, std::size_t value_length, double &expansion, std::vector<std::string> &phrases)
+{
+	if (key_length == 0 || (value_length == key_length && memcmp(key, value, key_length) == 0))
+	{
+		return;
+	}
+
+	double ratio = (double)value_length / key_length;
+	expansion = ratio > expansion ? ratio : expansion;
+
+	unsigned cp;
+	std::size_t length = ReadUtf8((const unsigned char *)key, key_length, cp);
+	if (length == key_length)
+	{
+		key_chars_.Insert(cp);
+	}
+	else
+	{
+		phrases.emplace_back(key, key_length);
+	}
+}
+
+void Profile::Convert(std::string const &in_utf8, std::string &out) const
+{
+	if (fused_)
+	{
+		engine_.Convert(in_utf8.data(), in_utf8.length(), out);
+		return;
+	}
+
+	out = converter_->Convert(in_utf8);
+}
+
+std::size_t Profile::Convert(const char *in_utf8, std::size_t length, char *out, std::size_t capacity) const
+{
+	if (fused_)
+	{
+		return engine_.Convert(in_utf8, length, out, capacity);
+	}
+
+	std::string converted = converter_->Convert(std::string(in_utf8, length));
+	if (converted.length() <= capacity)
+	{
+		memcpy(out, converted.data(), converted.length());
+	}
+
+	return converted.length();
+}
+
+std::size_t Profile::MaxConvertedLength(std::size_t length) const
+{
+	// Rounded up, with a little slack for the floating point.
+	return (std::size_t)(length * max_expansion_) + 16;
+}
+
+bool Profile::MayConvert(const char *utf8, std::size_t length) const
+{
+	return ContainsAnyOf(utf8, length, key_chars_);
+}
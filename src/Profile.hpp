@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencc/Common.hpp>
+#include "CodepointSet.hpp"
+#include "ConversionEngine.hpp"
+#include "MappedDict.hpp"
+
+// An OpenCC conversion profile (s2t.json, s2twp.json, ...), or a composed
+// .ccd dictionary standing in for one, loaded once per run and shared by
+// every file.
+class Profile
+{
+public:
+	// Throws opencc::Exception if the profile or its dictionaries can't be
+	// loaded. engine is "fused" to convert with ConversionEngine where it
+	// mirrors the profile, or "opencc" to always go through OpenCC.
+	void Load(std::string const &config_file, std::string const &engine);
+
+	// The engine actually in use.
+	const char *EngineName() const
+	{
+		return fused_ ? "fused" : "opencc";
+	}
+
+	void Convert(std::string const &in_utf8, std::string &out) const;
+
+	// Converts into a caller's buffer and returns the converted length. If
+	// that is more than capacity, nothing past capacity has been written; a
+	// buffer of MaxConvertedLength(length) bytes always fits.
+	std::size_t Convert(const char *in_utf8, std::size_t length, char *out, std::size_t capacity) const;
+
+	// No text of this many bytes converts to more than this.
+	std::size_t MaxConvertedLength(std::size_t length) const;
+
+	// False if the text contains no character of KeyChars, in which case
+	// Convert would return it unchanged.
+	bool MayConvert(const char *utf8, std::size_t length) const;
+
+	bool MayConvert(std::string const &utf8) const
+	{
+		return MayConvert(utf8.data(), utf8.length());
+	}
+
+	// At least one character of every dictionary key that doesn't map to
+	// itself, across the whole conversion chain.
+	CodepointSet const &KeyChars() const
+	{
+		return key_chars_;
+	}
+
+private:
+	// Adds an entry's key to key_chars_, or to phrases to be covered once
+	// every single character is in, and raises expansion to its ratio.
+	void AddKey(const char *key, std::size_t key_length, const char *value, std::size_t value_length, double &expansion, std::vector<std::string> &phrases);
+
+	std::shared_ptr<MappedDict> mapped_;
+	opencc::ConverterPtr converter_;
+	ConversionEngine engine_;
+	bool fused_;
+	CodepointSet key_chars_;
+	// Bytes out per byte in, at most, across the whole chain.
+	double max_expansion_;
+};
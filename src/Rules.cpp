@@ -0,0 +1,252 @@
+#include "Rules.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+// '*' and '?' stop at '/', '**' doesn't, and '**/' also matches no directory
+// at all.
+static bool GlobMatch(const char *p, const char *pe, const char *t, const char *te)
+{
+	while (p < pe)
+	{
+		if (*p == '*')
+		{
+			bool deep = p + 1 < pe && p[1] == '*';
+			p += deep ? 2 : 1;
+			if (deep && p < pe && *p == '/' && GlobMatch(p + 1, pe, t, te))
+			{
+				return true;
+			}
+
+			for (const char *s = t;; s++)
+			{
+				if (GlobMatch(p, pe, s, te))
+				{
+					return true;
+				}
+
+				if (s == te || (!deep && *s == '/'))
+				{
+					return false;
+				}
+			}
+		}
+
+		if (t == te || (*p == '?' ? *t == '/' : *p != *t))
+		{
+			return false;
+		}
+
+		p++;
+		t++;
+	}
+
+	return t == te;
+}
+
+Glob::Glob(std::string const &pattern)
+{
+	pattern_ = pattern;
+	if (!pattern_.empty() && pattern_[0] == '/')
+	{
+		pattern_.erase(0, 1);
+		basename_ = false;
+	}
+	else
+	{
+		basename_ = pattern_.find('/') == std::string::npos;
+	}
+
+	std::size_t wildcard = pattern_.find_first_of("*?");
+	literal_prefix_ = basename_ ? std::string() : pattern_.substr(0, wildcard);
+
+	// Most patterns are a plain name, a directory with everything beneath it,
+	// or a name suffix; only the rest need the general matcher.
+	if (wildcard == std::string::npos)
+	{
+		kind_ = kLiteral;
+	}
+	else if (wildcard + 2 == pattern_.length() && pattern_[wildcard + 1] == '*' &&
+		(wildcard == 0 || pattern_[wildcard - 1] == '/'))
+	{
+		kind_ = kPrefix;
+		pattern_.resize(wildcard);
+	}
+	else if (wildcard == 0 && pattern_.find_first_of("*?/", 1) == std::string::npos)
+	{
+		kind_ = kSuffix;
+		pattern_.erase(0, 1);
+	}
+	else
+	{
+		kind_ = kGeneral;
+	}
+}
+
+bool Glob::Match(std::string const &path) const
+{
+	const char *t = path.data();
+	const char *te = t + path.length();
+	if (basename_)
+	{
+		std::size_t slash = path.rfind('/');
+		if (slash != std::string::npos)
+		{
+			t += slash + 1;
+		}
+	}
+
+	std::size_t length = te - t;
+	switch (kind_)
+	{
+	case kLiteral:
+		return length == pattern_.length() && memcmp(t, pattern_.data(), length) == 0;
+	case kPrefix:
+		return length > pattern_.length() && memcmp(t, pattern_.data(), pattern_.length()) == 0;
+	case kSuffix:
+		return length >= pattern_.length() && memcmp(te - pattern_.length(), pattern_.data(), pattern_.length()) == 0;
+	default:
+		return GlobMatch(pattern_.data(), pattern_.data() + pattern_.length(), t, te);
+	}
+}
+
+static std::string ToLower(std::string text)
+{
+	std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+	return text;
+}
+
+void RuleSet::Compile(Options const &options)
+{
+	extensions_.clear();
+	for (std::string const &extension : options.exclude_extension)
+	{
+		extensions_.insert(ToLower(extension));
+	}
+
+	file_excludes_.clear();
+	directory_excludes_.clear();
+	for (std::string const &pattern : options.exclude_path)
+	{
+		if (!pattern.empty() && pattern.back() == '/')
+		{
+			directory_excludes_.emplace_back(pattern.substr(0, pattern.length() - 1));
+		}
+		else
+		{
+			file_excludes_.emplace_back(pattern);
+		}
+	}
+
+	includes_.clear();
+	for (std::string const &pattern : options.include_path)
+	{
+		includes_.emplace_back(!pattern.empty() && pattern.back() == '/' ? pattern + "**" : pattern);
+	}
+
+	max_file_size_ = options.max_file_size;
+}
+
+FileAction RuleSet::MatchFile(std::string const &path, std::uint64_t size) const
+{
+	bool included = false;
+	for (Glob const &include : includes_)
+	{
+		if (include.Match(path))
+		{
+			included = true;
+			break;
+		}
+	}
+
+	// Reached only where include_path keeps the walk inside an excluded
+	// directory; whatever it doesn't include there has no output, whatever
+	// its size.
+	if (!included && IsBeneathExcludedDirectory(path))
+	{
+		return FileAction::Skip;
+	}
+
+	if (max_file_size_ > 0 && size > max_file_size_)
+	{
+		return FileAction::Copy;
+	}
+
+	if (included)
+	{
+		return FileAction::Convert;
+	}
+
+	std::size_t slash = path.rfind('/');
+	std::size_t name = slash == std::string::npos ? 0 : slash + 1;
+	std::size_t dot = path.rfind('.');
+	if (!extensions_.empty() && dot != std::string::npos && dot > name &&
+		extensions_.count(ToLower(path.substr(dot))) > 0)
+	{
+		return FileAction::Copy;
+	}
+
+	for (Glob const &exclude : file_excludes_)
+	{
+		if (exclude.Match(path))
+		{
+			return FileAction::Copy;
+		}
+	}
+
+	return FileAction::Convert;
+}
+
+bool RuleSet::TraverseDirectory(std::string const &path) const
+{
+	return !(IsExcludedDirectory(path) || IsBeneathExcludedDirectory(path)) || MayIncludeBeneath(path);
+}
+
+bool RuleSet::IsExcludedDirectory(std::string const &path) const
+{
+	for (Glob const &exclude : directory_excludes_)
+	{
+		if (exclude.Match(path))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool RuleSet::IsBeneathExcludedDirectory(std::string const &path) const
+{
+	// Without includes, excluded directories are never traversed, so nothing
+	// beneath one gets here.
+	if (directory_excludes_.empty() || includes_.empty())
+	{
+		return false;
+	}
+
+	for (std::size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1))
+	{
+		if (IsExcludedDirectory(path.substr(0, slash)))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool RuleSet::MayIncludeBeneath(std::string const &path) const
+{
+	std::string directory = path + "/";
+	for (Glob const &include : includes_)
+	{
+		std::string const &prefix = include.LiteralPrefix();
+		if (prefix.compare(0, directory.length(), directory) == 0 ||
+			directory.compare(0, prefix.length(), prefix) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "Options.hpp"
+
+// A path pattern compiled once. Paths are relative to the input directory
+// with '/' separators. '*' and '?' stay within one path component, '**'
+// spans any number of them. A pattern without '/' matches the last
+// component at any depth, one with '/' is anchored at the input directory.
+class Glob
+{
+public:
+	explicit Glob(std::string const &pattern);
+
+	bool Match(std::string const &path) const;
+
+	// The part of the pattern before its first wildcard.
+	std::string const &LiteralPrefix() const
+	{
+		return literal_prefix_;
+	}
+
+private:
+	enum Kind
+	{
+		kLiteral,
+		kPrefix,
+		kSuffix,
+		kGeneral
+	};
+
+	Kind kind_;
+	bool basename_;
+	std::string pattern_;
+	std::string literal_prefix_;
+};
+
+enum class FileAction
+{
+	Convert,
+	Copy,
+	Skip
+};
+
+// exclude_extension, exclude_path, include_path and max_file_size compiled
+// for lookup per file. Excluded files are copied without conversion;
+// directories excluded by a pattern ending in '/' are left out of the output
+// altogether. A file matching include_path is converted whatever excludes it,
+// unless it is over max_file_size.
+class RuleSet
+{
+public:
+	void Compile(Options const &options);
+
+	FileAction MatchFile(std::string const &path, std::uint64_t size) const;
+
+	// False if the directory and everything beneath it can be skipped without
+	// visiting it.
+	bool TraverseDirectory(std::string const &path) const;
+
+private:
+	bool IsExcludedDirectory(std::string const &path) const;
+	bool IsBeneathExcludedDirectory(std::string const &path) const;
+	bool MayIncludeBeneath(std::string const &path) const;
+
+	std::unordered_set<std::string> extensions_;
+	std::vector<Glob> file_excludes_;
+	std::vector<Glob> directory_excludes_;
+	std::vector<Glob> includes_;
+	std::uint64_t max_file_size_;
+};
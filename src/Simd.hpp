@@ -0,0 +1,11 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CC_HAVE_SSE2 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CC_HAVE_AVX2 1
+#endif
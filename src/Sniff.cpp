@@ -0,0 +1,141 @@
+#include "Sniff.hpp"
+#include <cstring>
+
+static const std::size_t kSniffLength = 8192;
+
+// magic at offset, and then more at more_offset where more isn't empty.
+struct Signature
+{
+	std::size_t offset;
+	const char *magic;
+	std::size_t length;
+	std::size_t more_offset;
+	const char *more;
+	std::size_t more_length;
+};
+
+#define CC_SIGNATURE(offset, magic) { offset, magic, sizeof(magic) - 1, 0, "", 0 }
+#define CC_SIGNATURE2(offset, magic, more_offset, more) { offset, magic, sizeof(magic) - 1, more_offset, more, sizeof(more) - 1 }
+
+// Formats whose header alone is conclusive. Magic that a line of text could
+// start with, such as "ID3" or "BZh", is only taken together with the binary
+// bytes that follow it in the format. Formats that always have a NUL early
+// on, such as MP4 with the size ahead of "ftyp", are left to the sampling.
+static const Signature kSignatures[] = {
+	CC_SIGNATURE(0, "\x7F" "ELF"),
+	CC_SIGNATURE(0, "\xCA\xFE\xBA\xBE"),
+	CC_SIGNATURE(0, "\xFE\xED\xFA\xCE"),
+	CC_SIGNATURE(0, "\xFE\xED\xFA\xCF"),
+	CC_SIGNATURE(0, "\xCE\xFA\xED\xFE"),
+	CC_SIGNATURE(0, "\xCF\xFA\xED\xFE"),
+	CC_SIGNATURE(0, "!<arch>\n"),
+	CC_SIGNATURE(0, "\x00" "asm"),
+	CC_SIGNATURE(0, "\x89PNG\r\n\x1A\n"),
+	CC_SIGNATURE(0, "\xFF\xD8\xFF"),
+	CC_SIGNATURE(0, "GIF87a"),
+	CC_SIGNATURE(0, "GIF89a"),
+	CC_SIGNATURE(0, "II*\x00"),
+	CC_SIGNATURE(0, "MM\x00*"),
+	CC_SIGNATURE2(0, "RIFF", 8, "WAVE"),
+	CC_SIGNATURE2(0, "RIFF", 8, "AVI "),
+	CC_SIGNATURE2(0, "RIFF", 8, "WEBP"),
+	// Stream structure version 0.
+	CC_SIGNATURE(0, "OggS\x00"),
+	// The STREAMINFO block, 34 bytes long, comes first; the top bit marks
+	// it as the last block.
+	CC_SIGNATURE(0, "fLaC\x00\x00\x00\x22"),
+	CC_SIGNATURE(0, "fLaC\x80\x00\x00\x22"),
+	// Major version 2 to 4, revision 0.
+	CC_SIGNATURE(0, "ID3\x02\x00"),
+	CC_SIGNATURE(0, "ID3\x03\x00"),
+	CC_SIGNATURE(0, "ID3\x04\x00"),
+	CC_SIGNATURE(0, "PK\x03\x04"),
+	CC_SIGNATURE(0, "PK\x05\x06"),
+	CC_SIGNATURE(0, "Rar!\x1A\x07"),
+	CC_SIGNATURE(0, "7z\xBC\xAF\x27\x1C"),
+	CC_SIGNATURE(0, "\x1F\x8B"),
+	// A block size digit, then the block magic 0x314159265359.
+	CC_SIGNATURE2(0, "BZh", 4, "\x31\x41\x59\x26\x53\x59"),
+	CC_SIGNATURE(0, "\xFD" "7zXZ\x00"),
+	CC_SIGNATURE(0, "\x28\xB5\x2F\xFD"),
+	CC_SIGNATURE(0, "SQLite format 3\x00"),
+	CC_SIGNATURE(0, "\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1"),
+};
+
+#undef CC_SIGNATURE
+#undef CC_SIGNATURE2
+
+static bool IsDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// A header line such as "%PDF-1.7" then a comment line opening with at least
+// four bytes of 0x80 or above, which PDF writers add to mark the file binary.
+static bool IsPdf(const char *data, std::size_t length)
+{
+	if (length < 8 || memcmp(data, "%PDF-", 5) != 0 || !IsDigit(data[5]) || data[6] != '.' || !IsDigit(data[7]))
+	{
+		return false;
+	}
+
+	std::size_t i = 8;
+	while (i < length && (data[i] == '\r' || data[i] == '\n'))
+	{
+		i++;
+	}
+
+	if (i == 8 || length < i + 5 || data[i] != '%')
+	{
+		return false;
+	}
+
+	for (std::size_t j = i + 1; j < i + 5; j++)
+	{
+		if ((unsigned char)data[j] < 0x80)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool IsBinary(const char *data, std::size_t length)
+{
+	if (IsPdf(data, length))
+	{
+		return true;
+	}
+
+	for (Signature const &signature : kSignatures)
+	{
+		if (length >= signature.offset + signature.length &&
+			memcmp(data + signature.offset, signature.magic, signature.length) == 0 &&
+			length >= signature.more_offset + signature.more_length &&
+			memcmp(data + signature.more_offset, signature.more, signature.more_length) == 0)
+		{
+			return true;
+		}
+	}
+
+	std::size_t sample = length < kSniffLength ? length : kSniffLength;
+	std::size_t control = 0;
+	for (std::size_t i = 0; i < sample; i++)
+	{
+		unsigned char c = (unsigned char)data[i];
+		if (c == 0)
+		{
+			return true;
+		}
+
+		// Tab, line breaks, form feed and the escape of ANSI-coloured logs are
+		// all at home in text.
+		if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\v' && c != 0x1B) || c == 0x7F)
+		{
+			control++;
+		}
+	}
+
+	return control * 10 > sample;
+}
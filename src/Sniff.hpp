@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+// Classifies content as binary from a known file signature, any NUL byte, or
+// a high density of control characters in the first few KB. UTF-16 must be
+// ruled out first, since its ASCII range is full of NUL bytes.
+bool IsBinary(const char *data, std::size_t length);
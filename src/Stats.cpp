@@ -0,0 +1,77 @@
+#include "Stats.hpp"
+#include <algorithm>
+#include <cctype>
+
+static void PrintLine(std::ostream &os, const char *name, std::uint64_t files, std::uint64_t bytes)
+{
+	os << name << ": " << files << " files, " << bytes << " bytes" << std::endl;
+}
+
+void Stats::CountExtension(std::string const &extension, bool binary, std::uint64_t bytes)
+{
+	// Folded as exclude_extension is matched, so ".PNG" and ".png" count as one.
+	std::string key = extension;
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+	std::lock_guard<std::mutex> lock(extensions_mutex);
+	ExtensionCount &count = extensions[key];
+	if (binary)
+	{
+		count.binary_files++;
+		count.binary_bytes += bytes;
+	}
+	else
+	{
+		count.text_files++;
+	}
+}
+
+void PrintStats(Stats &stats, std::ostream &os)
+{
+	PrintLine(os, "converted", stats.converted_files, stats.converted_bytes);
+	PrintLine(os, "excluded", stats.excluded_files, stats.excluded_bytes);
+	os << "excluded directories: " << stats.pruned_directories << " pruned, "
+		<< stats.skipped_files << " files beneath skipped" << std::endl;
+	if (stats.failed_directories > 0)
+	{
+		os << "failed directories: " << stats.failed_directories << " left out" << std::endl;
+	}
+
+	PrintLine(os, "ascii skipped", stats.ascii_files, stats.ascii_bytes);
+	PrintLine(os, "unchanged skipped", stats.unchanged_files, stats.unchanged_bytes);
+	PrintLine(os, "binary skipped", stats.binary_files, stats.binary_bytes);
+
+	os << "size classes: " << stats.small_files << " small (< " << stats.small_file_size << " bytes, batched), "
+		<< stats.medium_files << " medium, " << stats.large_files << " large";
+	if (stats.large_file_size > 0)
+	{
+		os << " (>= " << stats.large_file_size << " bytes, " << stats.large_chunks << " chunks)";
+	}
+
+	os << std::endl;
+
+	os << "memory in flight: " << stats.inflight_high_water << " bytes at most";
+	if (stats.max_inflight_bytes > 0)
+	{
+		os << " of " << stats.max_inflight_bytes << " budgeted";
+	}
+
+	os << std::endl;
+
+	std::uint64_t files = stats.converted_files + stats.excluded_files + stats.ascii_files +
+		stats.unchanged_files + stats.binary_files;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stats.start).count();
+	os << "elapsed: " << seconds << " s, " << (seconds > 0 ? files / seconds : 0) << " files/s" << std::endl;
+
+	// Only extensions that had binary content are worth a look.
+	std::lock_guard<std::mutex> lock(stats.extensions_mutex);
+	for (auto const &item : stats.extensions)
+	{
+		Stats::ExtensionCount const &count = item.second;
+		if (count.binary_files > 0)
+		{
+			os << "  " << (item.first.empty() ? "(none)" : item.first) << ": "
+				<< count.binary_files << " binary (" << count.binary_bytes << " bytes), "
+				<< count.text_files << " text" << std::endl;
+		}
+	}
+}
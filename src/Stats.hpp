@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Counters for the end-of-run summary.
+struct Stats
+{
+	std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+
+	std::atomic<std::uint64_t> converted_files{0};
+	std::atomic<std::uint64_t> converted_bytes{0};
+	std::atomic<std::uint64_t> excluded_files{0};
+	std::atomic<std::uint64_t> excluded_bytes{0};
+	// Beneath an excluded directory, left out of the output.
+	std::atomic<std::uint64_t> skipped_files{0};
+	std::atomic<std::uint64_t> pruned_directories{0};
+	// Couldn't be walked, so left out with everything beneath them.
+	std::uint64_t failed_directories = 0;
+	// Pure ASCII, copied as is.
+	std::atomic<std::uint64_t> ascii_files{0};
+	std::atomic<std::uint64_t> ascii_bytes{0};
+	// No character the profile converts; conversion skipped.
+	std::atomic<std::uint64_t> unchanged_files{0};
+	std::atomic<std::uint64_t> unchanged_bytes{0};
+	// Detected as binary by content and copied as is.
+	std::atomic<std::uint64_t> binary_files{0};
+	std::atomic<std::uint64_t> binary_bytes{0};
+
+	// How conversions were routed by size, and the thresholds used.
+	std::atomic<std::uint64_t> small_files{0};
+	std::atomic<std::uint64_t> medium_files{0};
+	std::atomic<std::uint64_t> large_files{0};
+	std::atomic<std::uint64_t> large_chunks{0};
+	std::uint64_t small_file_size = 0;
+	std::uint64_t large_file_size = 0;
+
+	// Memory budget for files in flight, and the most reserved at once.
+	std::uint64_t max_inflight_bytes = 0;
+	std::uint64_t inflight_high_water = 0;
+
+	struct ExtensionCount
+	{
+		std::uint64_t text_files;
+		std::uint64_t binary_files;
+		std::uint64_t binary_bytes;
+	};
+
+	// Content classification by extension, to help tune exclude_extension.
+	std::mutex extensions_mutex;
+	std::map<std::string, ExtensionCount> extensions;
+
+	void CountExtension(std::string const &extension, bool binary, std::uint64_t bytes);
+};
+
+void PrintStats(Stats &stats, std::ostream &os);
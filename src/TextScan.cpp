@@ -0,0 +1,118 @@
+#include "TextScan.hpp"
+#include "CodepointSet.hpp"
+#include "Simd.hpp"
+#include "Utf8.hpp"
+
+bool IsAscii(const char *data, std::size_t length)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + length;
+
+	// OR 64 bytes together per iteration and test the sign bits once.
+#if defined(CC_HAVE_AVX2)
+	while (end - p >= 64)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *)p);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+		if (_mm256_movemask_epi8(_mm256_or_si256(a, b)) != 0)
+		{
+			return false;
+		}
+
+		p += 64;
+	}
+#elif defined(CC_HAVE_SSE2)
+	while (end - p >= 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)p);
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(p + 48));
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0)
+		{
+			return false;
+		}
+
+		p += 64;
+	}
+#endif
+
+	for (; p < end; p++)
+	{
+		if (*p & 0x80)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool IsUtf8(const char *data, std::size_t length)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + length;
+	while (p < end)
+	{
+		if (*p < 0x80)
+		{
+			p++;
+#ifdef CC_HAVE_SSE2
+			while (end - p >= 16 && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)) == 0)
+			{
+				p += 16;
+			}
+#endif
+			continue;
+		}
+
+		// ReadUtf8 gives 1 only for a malformed sequence, past ASCII.
+		unsigned cp;
+		std::size_t sequence = ReadUtf8(p, end - p, cp);
+		if (sequence == 1)
+		{
+			return false;
+		}
+
+		p += sequence;
+	}
+
+	return true;
+}
+
+bool ContainsAnyOf(const char *utf8, std::size_t length, CodepointSet const &set)
+{
+	const unsigned char *p = (const unsigned char *)utf8;
+	const unsigned char *end = p + length;
+	bool skip_ascii = !set.HasAscii();
+
+	while (p < end)
+	{
+		if (*p < 0x80)
+		{
+			if (!skip_ascii && set.Contains(*p))
+			{
+				return true;
+			}
+
+			p++;
+#ifdef CC_HAVE_SSE2
+			// Leap over ASCII runs such as markup and whitespace 16 bytes at a time.
+			while (skip_ascii && end - p >= 16 && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)) == 0)
+			{
+				p += 16;
+			}
+#endif
+			continue;
+		}
+
+		unsigned cp;
+		p += ReadUtf8(p, end - p, cp);
+		if (set.Contains(cp))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
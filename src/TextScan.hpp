@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Returns true if no byte has the high bit set, i.e. the text is the same in
+// ASCII, UTF-8 and every ASCII-compatible charset.
+bool IsAscii(const char *data, std::size_t length);
+
+inline bool IsAscii(std::string const &text)
+{
+	return IsAscii(text.data(), text.length());
+}
+
+// Returns true if the text is well-formed UTF-8: no malformed, overlong or
+// surrogate sequences and none cut short at the end.
+bool IsUtf8(const char *data, std::size_t length);
+
+class CodepointSet;
+
+// Returns true if any character of the UTF-8 text is in the set. Malformed
+// sequences are looked up as U+FFFD.
+bool ContainsAnyOf(const char *utf8, std::size_t length, CodepointSet const &set);
@@ -0,0 +1,84 @@
+#include "ThreadPool.hpp"
+#include <exception>
+#include <iostream>
+
+ThreadPool::ThreadPool(std::size_t threads) : running_(0), stopping_(false)
+{
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+
+	for (std::size_t i = 0; i < threads; i++)
+	{
+		threads_.emplace_back(&ThreadPool::Run, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+
+	task_ready_.notify_all();
+	for (std::thread &thread : threads_)
+	{
+		thread.join();
+	}
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+
+	task_ready_.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this] { return tasks_.empty() && running_ == 0; });
+}
+
+void ThreadPool::Run()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			task_ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+			if (tasks_.empty())
+			{
+				return;
+			}
+
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+			running_++;
+		}
+
+		try
+		{
+			task();
+		}
+		catch (std::exception const &ex)
+		{
+			std::cerr << "Error:" << ex.what() << std::endl;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_--;
+			if (tasks_.empty() && running_ == 0)
+			{
+				idle_.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads draining a FIFO task queue.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(std::size_t threads);
+
+	// Finishes every queued task before joining the workers.
+	~ThreadPool();
+
+	ThreadPool(ThreadPool const &) = delete;
+	ThreadPool &operator=(ThreadPool const &) = delete;
+
+	void Submit(std::function<void()> task);
+
+	// Blocks until the queue is empty and no task is running.
+	void Wait();
+
+	std::size_t Size() const
+	{
+		return threads_.size();
+	}
+
+private:
+	void Run();
+
+	std::vector<std::thread> threads_;
+	std::deque<std::function<void()>> tasks_;
+	std::mutex mutex_;
+	std::condition_variable task_ready_;
+	std::condition_variable idle_;
+	std::size_t running_;
+	bool stopping_;
+};
@@ -0,0 +1,259 @@
+#include "Utf16.hpp"
+#include "Simd.hpp"
+#include "Utf8.hpp"
+
+static const std::size_t kUtf16SampleLength = 4096;
+
+bool DetectUtf16(const char *data, std::size_t length, Utf16Format &format)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	if (length >= 2)
+	{
+		// FF FE 00 00 is the UTF-32LE byte order mark, which is not ours to handle.
+		if (bytes[0] == 0xFF && bytes[1] == 0xFE && !(length >= 4 && bytes[2] == 0 && bytes[3] == 0))
+		{
+			format.big_endian = false;
+			format.has_bom = true;
+			return true;
+		}
+
+		if (bytes[0] == 0xFE && bytes[1] == 0xFF)
+		{
+			format.big_endian = true;
+			format.has_bom = true;
+			return true;
+		}
+	}
+
+	if (length % 2 != 0)
+	{
+		return false;
+	}
+
+	std::size_t sample = length < kUtf16SampleLength ? length : kUtf16SampleLength;
+	std::size_t units = sample / 2;
+	if (units < 4)
+	{
+		return false;
+	}
+
+	std::size_t even_zero = 0;
+	std::size_t odd_zero = 0;
+	for (std::size_t i = 0; i < sample; i += 2)
+	{
+		// U+0000 has no place in text, but binary data is full of it.
+		if (bytes[i] == 0 && bytes[i + 1] == 0)
+		{
+			return false;
+		}
+
+		even_zero += bytes[i] == 0;
+		odd_zero += bytes[i + 1] == 0;
+	}
+
+	// ASCII-range text puts a NUL in the high byte of most units, while the low
+	// byte is almost never NUL. Anything less lopsided is left to uchardet.
+	if (odd_zero * 10 >= units * 4 && even_zero * 20 <= units)
+	{
+		format.big_endian = false;
+		format.has_bom = false;
+		return true;
+	}
+
+	if (even_zero * 10 >= units * 4 && odd_zero * 20 <= units)
+	{
+		format.big_endian = true;
+		format.has_bom = false;
+		return true;
+	}
+
+	return false;
+}
+
+static inline unsigned ReadUnit(const unsigned char *p, bool big_endian)
+{
+	return big_endian ? ((unsigned)p[0] << 8) | p[1] : ((unsigned)p[1] << 8) | p[0];
+}
+
+static inline char *WriteUtf8(char *dst, unsigned cp)
+{
+	if (cp < 0x80)
+	{
+		*dst++ = (char)cp;
+	}
+	else if (cp < 0x800)
+	{
+		*dst++ = (char)(0xC0 | (cp >> 6));
+		*dst++ = (char)(0x80 | (cp & 0x3F));
+	}
+	else if (cp < 0x10000)
+	{
+		*dst++ = (char)(0xE0 | (cp >> 12));
+		*dst++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+		*dst++ = (char)(0x80 | (cp & 0x3F));
+	}
+	else
+	{
+		*dst++ = (char)(0xF0 | (cp >> 18));
+		*dst++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+		*dst++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+		*dst++ = (char)(0x80 | (cp & 0x3F));
+	}
+
+	return dst;
+}
+
+void Utf16ToUtf8(const char *data, std::size_t length, Utf16Format const &format, std::string &out)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + (length & ~(std::size_t)1);
+	if (format.has_bom && end - p >= 2)
+	{
+		p += 2;
+	}
+
+	// Every code unit yields at most three bytes, a surrogate pair four.
+	out.resize((end - p) / 2 * 3 + 3);
+	char *begin = &out[0];
+	char *dst = begin;
+	bool big_endian = format.big_endian;
+
+	while (p < end)
+	{
+#ifdef CC_HAVE_SSE2
+		// Narrow eight ASCII code units per iteration for as long as they last.
+		const __m128i high_mask = _mm_set1_epi16((short)0xFF80);
+		while (end - p >= 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			if (big_endian)
+			{
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			}
+
+			__m128i high = _mm_and_si128(v, high_mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF)
+			{
+				break;
+			}
+
+			_mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(v, v));
+			p += 16;
+			dst += 8;
+		}
+#endif
+
+		// Non-ASCII units go one at a time until the next ASCII unit.
+		while (p < end)
+		{
+			unsigned unit = ReadUnit(p, big_endian);
+			p += 2;
+			if (unit < 0x80)
+			{
+				*dst++ = (char)unit;
+				break;
+			}
+
+			if (unit >= 0xD800 && unit <= 0xDBFF && end - p >= 2)
+			{
+				unsigned low = ReadUnit(p, big_endian);
+				if (low >= 0xDC00 && low <= 0xDFFF)
+				{
+					p += 2;
+					dst = WriteUtf8(dst, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+					continue;
+				}
+			}
+
+			if (unit >= 0xD800 && unit <= 0xDFFF)
+			{
+				unit = kReplacementCharacter;
+			}
+
+			dst = WriteUtf8(dst, unit);
+		}
+	}
+
+	if (length % 2 != 0)
+	{
+		dst = WriteUtf8(dst, kReplacementCharacter);
+	}
+
+	out.resize(dst - begin);
+}
+
+static inline char *WriteUnit(char *dst, unsigned unit, bool big_endian)
+{
+	if (big_endian)
+	{
+		*dst++ = (char)(unit >> 8);
+		*dst++ = (char)(unit & 0xFF);
+	}
+	else
+	{
+		*dst++ = (char)(unit & 0xFF);
+		*dst++ = (char)(unit >> 8);
+	}
+
+	return dst;
+}
+
+void Utf8ToUtf16(std::string const &in, Utf16Format const &format, std::string &out)
+{
+	const unsigned char *p = (const unsigned char *)in.data();
+	const unsigned char *end = p + in.length();
+	bool big_endian = format.big_endian;
+
+	// A UTF-8 byte never yields more than two bytes of UTF-16.
+	out.resize(in.length() * 2 + 2);
+	char *begin = &out[0];
+	char *dst = begin;
+	if (format.has_bom)
+	{
+		dst = WriteUnit(dst, 0xFEFF, big_endian);
+	}
+
+	while (p < end)
+	{
+#ifdef CC_HAVE_SSE2
+		// Widen sixteen ASCII bytes per iteration for as long as they last.
+		while (end - p >= 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			if (_mm_movemask_epi8(v) != 0)
+			{
+				break;
+			}
+
+			__m128i zero = _mm_setzero_si128();
+			__m128i lo = big_endian ? _mm_unpacklo_epi8(zero, v) : _mm_unpacklo_epi8(v, zero);
+			__m128i hi = big_endian ? _mm_unpackhi_epi8(zero, v) : _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_si128((__m128i *)dst, lo);
+			_mm_storeu_si128((__m128i *)(dst + 16), hi);
+			p += 16;
+			dst += 32;
+		}
+#endif
+
+		while (p < end)
+		{
+			unsigned cp;
+			p += ReadUtf8(p, end - p, cp);
+			if (cp >= 0x10000)
+			{
+				cp -= 0x10000;
+				dst = WriteUnit(dst, 0xD800 + (cp >> 10), big_endian);
+				dst = WriteUnit(dst, 0xDC00 + (cp & 0x3FF), big_endian);
+				continue;
+			}
+
+			dst = WriteUnit(dst, cp, big_endian);
+			if (cp < 0x80)
+			{
+				break;
+			}
+		}
+	}
+
+	out.resize(dst - begin);
+}
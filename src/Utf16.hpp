@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+struct Utf16Format
+{
+	bool big_endian;
+	bool has_bom;
+};
+
+// Detects UTF-16 by its byte order mark, or without one by the NUL bytes that
+// ASCII-range text leaves in one half of every code unit.
+bool DetectUtf16(const char *data, std::size_t length, Utf16Format &format);
+
+// Transcodes UTF-16 to UTF-8, skipping the byte order mark if there is one.
+// Unpaired surrogates and a trailing odd byte become U+FFFD.
+void Utf16ToUtf8(const char *data, std::size_t length, Utf16Format const &format, std::string &out);
+
+// Transcodes UTF-8 back to UTF-16 in the given byte order, writing a byte order
+// mark if the format has one. Invalid UTF-8 bytes become U+FFFD.
+void Utf8ToUtf16(std::string const &in, Utf16Format const &format, std::string &out);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+
+static const unsigned kReplacementCharacter = 0xFFFD;
+
+// Decodes one UTF-8 sequence and returns its length, or 1 with U+FFFD for a
+// malformed, overlong or surrogate sequence.
+inline std::size_t ReadUtf8(const unsigned char *p, std::size_t left, unsigned &cp)
+{
+	unsigned lead = p[0];
+	std::size_t length;
+	unsigned min;
+	if (lead < 0x80)
+	{
+		cp = lead;
+		return 1;
+	}
+	else if ((lead & 0xE0) == 0xC0)
+	{
+		length = 2;
+		min = 0x80;
+		cp = lead & 0x1F;
+	}
+	else if ((lead & 0xF0) == 0xE0)
+	{
+		length = 3;
+		min = 0x800;
+		cp = lead & 0x0F;
+	}
+	else if ((lead & 0xF8) == 0xF0)
+	{
+		length = 4;
+		min = 0x10000;
+		cp = lead & 0x07;
+	}
+	else
+	{
+		cp = kReplacementCharacter;
+		return 1;
+	}
+
+	if (left < length)
+	{
+		cp = kReplacementCharacter;
+		return 1;
+	}
+
+	for (std::size_t i = 1; i < length; i++)
+	{
+		if ((p[i] & 0xC0) != 0x80)
+		{
+			cp = kReplacementCharacter;
+			return 1;
+		}
+
+		cp = (cp << 6) | (p[i] & 0x3F);
+	}
+
+	if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+	{
+		cp = kReplacementCharacter;
+		return 1;
+	}
+
+	return length;
+}
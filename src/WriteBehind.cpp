@@ -0,0 +1,85 @@
+#include "WriteBehind.hpp"
+#include <cstring>
+#include <iostream>
+
+// Held outputs already count against the memory budget, so the queue only
+// needs to be deep enough to keep every thread busy.
+static const std::size_t kQueuedBatches = 64;
+
+WriteBehind::WriteBehind(std::string const &backend_name, std::size_t threads, MemoryBudget &budget, Durability &durability)
+	: budget_(budget), durability_(durability), queue_(kQueuedBatches)
+{
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+
+	for (std::size_t i = 0; i < threads; i++)
+	{
+		backends_.push_back(NewIoBackend(backend_name));
+	}
+
+	for (std::size_t i = 0; i < threads; i++)
+	{
+		threads_.emplace_back(&WriteBehind::Run, this, std::ref(*backends_[i]));
+	}
+}
+
+WriteBehind::~WriteBehind()
+{
+	Finish();
+}
+
+void WriteBehind::Submit(std::vector<IoFile> files, std::uint64_t footprint)
+{
+	Batch batch;
+	batch.files = std::move(files);
+	batch.footprint = footprint;
+	queue_.Push(std::move(batch));
+}
+
+void WriteBehind::Finish()
+{
+	queue_.Close();
+	for (std::thread &thread : threads_)
+	{
+		thread.join();
+	}
+
+	threads_.clear();
+}
+
+void WriteBehind::Run(IoBackend &backend)
+{
+	Batch batch;
+	std::vector<FileLocation> outputs;
+	while (queue_.Pop(batch))
+	{
+		if (durability_.Staged())
+		{
+			outputs.clear();
+			for (IoFile &file : batch.files)
+			{
+				outputs.push_back(file.location);
+				file.location = durability_.Target(file.location);
+			}
+		}
+
+		backend.WriteFiles(batch.files);
+		for (std::size_t i = 0; i < batch.files.size(); i++)
+		{
+			IoFile const &file = batch.files[i];
+			if (file.error != 0)
+			{
+				std::cerr << "write error: " << file.location.path.u8string() << ": " << strerror(file.error) << std::endl;
+			}
+			else if (durability_.Staged())
+			{
+				durability_.Commit(outputs[i]);
+			}
+		}
+
+		batch.files.clear();
+		budget_.Release(batch.footprint);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.hpp"
+#include "Durability.hpp"
+#include "IoBackend.hpp"
+#include "MemoryBudget.hpp"
+
+// Writes finished outputs on threads of its own, so that conversion threads
+// hand them over and carry on instead of waiting on the disk. Each thread
+// drives its own I/O backend, and commits what it wrote through durability.
+class WriteBehind
+{
+public:
+	WriteBehind(std::string const &backend_name, std::size_t threads, MemoryBudget &budget, Durability &durability);
+
+	// Writes everything queued before joining.
+	~WriteBehind();
+
+	WriteBehind(WriteBehind const &) = delete;
+	WriteBehind &operator=(WriteBehind const &) = delete;
+
+	// Queues the files for writing. footprint is returned to the budget once
+	// they are written. Write errors are reported as they happen.
+	void Submit(std::vector<IoFile> files, std::uint64_t footprint);
+
+	// Writes everything queued and stops the threads.
+	void Finish();
+
+private:
+	struct Batch
+	{
+		std::vector<IoFile> files;
+		std::uint64_t footprint;
+	};
+
+	void Run(IoBackend &backend);
+
+	MemoryBudget &budget_;
+	Durability &durability_;
+	BoundedQueue<Batch> queue_;
+	std::vector<std::unique_ptr<IoBackend>> backends_;
+	std::vector<std::thread> threads_;
+};
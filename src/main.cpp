@@ -2,11 +2,36 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
-#include <opencc/opencc.h>
+#include <chrono>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <opencc/Exception.hpp>
 #include <ghc/filesystem.hpp>
 #include <uchardet/uchardet.h>
 #include <iconv/iconv.h>
-#include <yaml-cpp/yaml.h>
+#include "BoundedQueue.hpp"
+#include "DirWalk.hpp"
+#include "Durability.hpp"
+#include "FileCopy.hpp"
+#include "IoBackend.hpp"
+#include "MemoryBudget.hpp"
+#include "OutputFile.hpp"
+#include "Options.hpp"
+#include "Profile.hpp"
+#include "Rules.hpp"
+#include "Sniff.hpp"
+#include "Stats.hpp"
+#include "TextScan.hpp"
+#include "ThreadPool.hpp"
+#include "Utf16.hpp"
+#include "WriteBehind.hpp"
 
 namespace fs = ghc::filesystem;
 
@@ -53,56 +78,66 @@ bool CheckPathValid(fs::path &input_dir, fs::path &output_dir)
 
 int ConvertCode(std::string in_charset, std::string out_charset, std::string const &in, std::string &out)
 {
-	std::size_t in_length = in.length();
-	std::size_t in_left_len = in_length;
-
-	char *in_buffer = (char *)in.data();
-	char *in_left = in_buffer;
-
-	std::size_t out_length = in_length * 2;
-	std::size_t out_left_len = out_length;
-	char *out_buffer = (char*)malloc(out_length);
-	if (out_buffer == nullptr)
-	{
-		std::cerr << "malloc error" << std::endl;
-		return -1;
-	}
-
-	memset(out_buffer, 0, out_length);
-
-	char *out_left = out_buffer;	
-
 	iconv_t iconv_handle = iconv_open(out_charset.c_str(), in_charset.c_str());
 	if (iconv_handle == (iconv_t)(-1))
 	{
 		std::cerr << "iconv_open error" << std::endl;
-		free(out_buffer);
-		iconv_close(iconv_handle);
 		return -1;
 	}
 
-	std::size_t ret = iconv(iconv_handle, &in_left, &in_left_len, &out_left, &out_left_len);
-	if (ret == -1)
+	char *in_left = (char *)in.data();
+	std::size_t in_left_len = in.length();
+
+	// The output size can't be known up front (a single-byte charset can triple
+	// in UTF-8), so grow the buffer whenever iconv runs out of room.
+	std::string out_buffer;
+	out_buffer.resize(in.length() * 2 + 16);
+	std::size_t out_used = 0;
+	bool flushing = false;
+	while (true)
 	{
-		std::cerr << "iconv error" << std::endl;
-		free(out_buffer);
-		iconv_close(iconv_handle);
-		return -1;
+		char *out_left = &out_buffer[out_used];
+		std::size_t out_left_len = out_buffer.length() - out_used;
+		std::size_t ret = flushing
+			? iconv(iconv_handle, nullptr, nullptr, &out_left, &out_left_len)
+			: iconv(iconv_handle, &in_left, &in_left_len, &out_left, &out_left_len);
+		out_used = out_buffer.length() - out_left_len;
+		if (ret != (std::size_t)(-1))
+		{
+			if (flushing)
+			{
+				break;
+			}
+
+			// Stateful charsets may still owe a shift sequence.
+			flushing = true;
+			continue;
+		}
+
+		if (errno != E2BIG)
+		{
+			std::cerr << "iconv error" << std::endl;
+			iconv_close(iconv_handle);
+			return -1;
+		}
+
+		out_buffer.resize(out_buffer.length() * 2);
 	}
 
-	out = out_buffer;
-	free(out_buffer);
+	out_buffer.resize(out_used);
+	out = std::move(out_buffer);
 	iconv_close(iconv_handle);
 	return 0;
 }
 
-void Convert2Utf8(std::string const &in, std::string &out)
+std::string DetectCharset(std::string const &in)
 {
 	uchardet_t uchardet_handle = uchardet_new();
 	int ret = uchardet_handle_data(uchardet_handle, in.data(), in.length());
 	if (ret != 0)
 	{
-		return;
+		uchardet_delete(uchardet_handle);
+		return std::string();
 	}
 
 	uchardet_data_end(uchardet_handle);
@@ -110,6 +145,12 @@ void Convert2Utf8(std::string const &in, std::string &out)
 	uchardet_delete(uchardet_handle);
 
 	std::transform(charset.begin(), charset.end(), charset.begin(), ::toupper);
+	return charset;
+}
+
+void Convert2Utf8(std::string const &in, std::string &out)
+{
+	std::string charset = DetectCharset(in);
 
 	//std::cerr << "in:" << in << " charset:" << charset << std::endl;
 	if (charset.compare("UTF-8") != 0)
@@ -123,113 +164,838 @@ void Convert2Utf8(std::string const &in, std::string &out)
 	}
 }
 
-void ConvertSimple2Traditional(std::string const &in, std::string &out)
+void ConvertSimple2Traditional(Profile const &profile, std::string const &in, std::string &out)
 {
 	if (in.length() > 0)
 	{
 		std::string in_utf8;
 		Convert2Utf8(in, in_utf8);
-		const opencc::SimpleConverter converter("s2t.json");
-		out = converter.Convert(in_utf8);
+		profile.Convert(in_utf8, out);
 	}  
 }
 
-fs::path ConvertOutPath(fs::path &input_dir, fs::path &output_dir, fs::path &input_path)
+void ConvertOutFilename(Profile const &profile, FileLocation &output)
+{
+	if (!IsAscii(output.name))
+	{
+		std::string convert_output_filename;
+		ConvertSimple2Traditional(profile, output.name, convert_output_filename);
+		output.name = convert_output_filename;
+		output.path.replace_filename(fs::u8path(convert_output_filename));
+	}
+}
+
+enum class ContentAction
+{
+	Write,
+	// The output is the input as is.
+	Copy,
+	// The output was converted straight into the file.
+	Written
+};
+
+// Converts into a mapping of the output file sized for the longest the
+// output could be, with no output string in between. Returns false if the
+// file can't be mapped or written this way, to be written from a string.
+static bool ConvertMapped(Profile const &profile, std::string const &utf8, FileLocation const &target)
+{
+	MappedOutputFile output;
+	std::size_t capacity = profile.MaxConvertedLength(utf8.length());
+	if (output.Open(target, capacity) != 0)
+	{
+		return false;
+	}
+
+	std::size_t length = profile.Convert(utf8.data(), utf8.length(), output.Data(), capacity);
+	return output.Close(length) == 0;
+}
+
+// mapped_target, where not null, is where UTF-8 output that needs converting
+// is converted straight into, as ContentAction::Written.
+ContentAction ConvertContent(Profile const &profile, std::string const &extension, std::string const &content, bool keep_utf16, FileLocation const *mapped_target, Stats &stats, std::string &out)
+{
+	Utf16Format utf16_format;
+	bool is_utf16 = DetectUtf16(content.data(), content.length(), utf16_format);
+	bool is_binary = !is_utf16 && IsBinary(content.data(), content.length());
+	stats.CountExtension(extension, is_binary, content.length());
+	if (is_binary)
+	{
+		// Detecting, transcoding and segmenting would only corrupt it.
+		stats.binary_files++;
+		stats.binary_bytes += content.length();
+		return ContentAction::Copy;
+	}
+
+	if (!is_utf16 && IsAscii(content))
+	{
+		// Nothing in pure ASCII converts, so the input is its own output.
+		stats.ascii_files++;
+		stats.ascii_bytes += content.length();
+		return ContentAction::Copy;
+	}
+
+	// UTF-16 is transcoded here rather than left to uchardet and iconv.
+	std::string in_utf8;
+	bool is_utf8 = false;
+	if (is_utf16)
+	{
+		Utf16ToUtf8(content.data(), content.length(), utf16_format, in_utf8);
+	}
+	else
+	{
+		std::string charset = DetectCharset(content);
+		if (charset.compare("UTF-8") == 0)
+		{
+			is_utf8 = true;
+		}
+		else
+		{
+			ConvertCode(charset, "UTF-8", content, in_utf8);
+		}
+	}
+
+	std::string const &utf8 = is_utf8 ? content : in_utf8;
+	std::string converted;
+	std::string const *out_utf8 = &utf8;
+	if (profile.MayConvert(utf8))
+	{
+		if (mapped_target != nullptr && !(is_utf16 && keep_utf16) && ConvertMapped(profile, utf8, *mapped_target))
+		{
+			stats.converted_files++;
+			stats.converted_bytes += content.length();
+			return ContentAction::Written;
+		}
+
+		profile.Convert(utf8, converted);
+		out_utf8 = &converted;
+		stats.converted_files++;
+		stats.converted_bytes += content.length();
+	}
+	else
+	{
+		stats.unchanged_files++;
+		stats.unchanged_bytes += content.length();
+		if (is_utf8)
+		{
+			return ContentAction::Copy;
+		}
+	}
+
+	// UTF-16 goes back out in its original byte order when keep_utf16 is set.
+	if (is_utf16 && keep_utf16)
+	{
+		Utf8ToUtf16(*out_utf8, utf16_format, out);
+	}
+	else if (out_utf8 == &converted)
+	{
+		out = std::move(converted);
+	}
+	else
+	{
+		// Unconverted UTF-8 was copied as is above, so this is the transcoded text.
+		out = std::move(in_utf8);
+	}
+
+	return ContentAction::Write;
+}
+
+struct FileTask
+{
+	FileLocation input;
+	FileLocation output;
+	std::uint64_t size;
+};
+
+// Work that can wait far behind the walk, such as copies on the unbounded I/O
+// pool, holds its files by full path rather than keep their directories open
+// until it runs: otherwise a walk far ahead could run out of descriptors.
+static void ReleaseDirs(FileTask &task)
+{
+	task.input.dir.reset();
+	task.output.dir.reset();
+}
+
+// Files are read and written a batch at a time so that the I/O backend can
+// keep the whole batch in flight at once.
+static const std::size_t kBatchFiles = 64;
+static const std::uint64_t kBatchBytes = 16 << 20;
+// Files found by the walk but not yet taken into a batch.
+static const std::size_t kQueuedFiles = 1024;
+
+// Copies a file that passes through unchanged, committed like any other
+// output.
+static int CopyOutput(Durability &durability, FileLocation const &input, FileLocation const &output)
+{
+	if (CopyFileFast(input, durability.Target(output)) != 0)
+	{
+		return -1;
+	}
+
+	return durability.Commit(output) == 0 ? 0 : -1;
+}
+
+// What every conversion thread shares.
+struct ConvertContext
+{
+	Profile const &profile;
+	Options const &options;
+	// Copies files that pass through unchanged.
+	ThreadPool &io_pool;
+	// Converts chunks of large files.
+	ThreadPool &chunk_pool;
+	// Writes finished outputs.
+	WriteBehind &write_behind;
+	MemoryBudget &budget;
+	Durability &durability;
+	Stats &stats;
+};
+
+// A file converted whole is held as read, as UTF-8 and as output, each about
+// its size.
+static std::uint64_t EstimateFootprint(std::uint64_t size)
+{
+	return size * 3;
+}
+
+// Reads the batch and converts each file, leaving the outputs in writes.
+// Files that come out as they went in are copied on the I/O pool instead, and
+// in mmap output_mode those from small_file_size up are converted into their
+// output files directly.
+void ReadAndConvert(ConvertContext &context, IoBackend &backend, std::vector<FileTask> const &tasks, std::vector<IoFile> &reads, std::vector<IoFile> &writes, std::uint64_t &write_bytes)
+{
+	reads.resize(tasks.size());
+	for (std::size_t i = 0; i < tasks.size(); i++)
+	{
+		reads[i].location = tasks[i].input;
+		reads[i].size = tasks[i].size;
+	}
+
+	backend.ReadFiles(reads);
+
+	writes.reserve(tasks.size());
+	for (std::size_t i = 0; i < tasks.size(); i++)
+	{
+		FileTask const &task = tasks[i];
+		if (reads[i].error != 0)
+		{
+			std::cerr << "read error: " << task.input.path.u8string() << ": " << strerror(reads[i].error) << std::endl;
+			continue;
+		}
+
+		std::string out;
+		bool mapped = context.options.output_mode == "mmap" && task.size >= context.options.small_file_size;
+		FileLocation target = context.durability.Target(task.output);
+		ContentAction action = ConvertContent(context.profile, task.input.path.extension().u8string(), reads[i].data, context.options.keep_utf16, mapped ? &target : nullptr, context.stats, out);
+		if (action == ContentAction::Written)
+		{
+			context.durability.Commit(task.output);
+		}
+		else if (action == ContentAction::Copy)
+		{
+			Durability &durability = context.durability;
+			FileTask copy = task;
+			ReleaseDirs(copy);
+			context.io_pool.Submit([copy, &durability]() {
+				CopyOutput(durability, copy.input, copy.output);
+			});
+		}
+		else
+		{
+			writes.emplace_back();
+			writes.back().location = task.output;
+			writes.back().data = std::move(out);
+			write_bytes += writes.back().data.length();
+		}
+	}
+}
+
+// Converts a batch and hands the outputs to the write-behind threads. reads
+// holds the read buffers, kept by the caller so that one batch of small files
+// after another reuses them.
+void ConvertBatch(ConvertContext &context, IoBackend &backend, std::vector<FileTask> &tasks, std::vector<IoFile> &reads)
+{
+	std::uint64_t footprint = 0;
+	for (FileTask const &task : tasks)
+	{
+		footprint += EstimateFootprint(task.size);
+	}
+
+	context.budget.Acquire(footprint);
+	std::vector<IoFile> writes;
+	std::uint64_t write_bytes = 0;
+	try
+	{
+		ReadAndConvert(context, backend, tasks, reads, writes, write_bytes);
+	}
+	catch (...)
+	{
+		context.budget.Release(footprint);
+		throw;
+	}
+
+	// The outputs stay reserved until written; the rest is free already.
+	std::uint64_t held = write_bytes < footprint ? write_bytes : footprint;
+	context.budget.Release(footprint - held);
+	context.write_behind.Submit(std::move(writes), held);
+	tasks.clear();
+}
+
+// Huge files are streamed in chunks that end after a newline. No dictionary
+// key holds a newline, so converting the chunks apart gives the same text as
+// converting the whole, and the chunk pool can work on several at once.
+static const std::size_t kChunkLength = 8 << 20;
+
+// Where the chunk at the front of text ends. A line longer than a chunk is
+// cut in its back half, so that what is carried over stays bounded: after an
+// ASCII space or punctuation mark, which no key in OpenCC's dictionaries
+// holds either, or failing that between two characters.
+static std::size_t FindCut(std::string const &text)
+{
+	std::size_t newline = text.rfind('\n');
+	if (newline != std::string::npos)
+	{
+		return newline + 1;
+	}
+
+	std::size_t half = text.length() / 2;
+	for (std::size_t i = text.length(); i > half; i--)
+	{
+		unsigned char c = (unsigned char)text[i - 1];
+		if (c < 0x80 && !isalnum(c))
+		{
+			return i;
+		}
+	}
+
+	// Before the last character's lead byte, in case it isn't all there.
+	std::size_t i = text.length() - 1;
+	while (i > half && ((unsigned char)text[i] & 0xC0) == 0x80)
+	{
+		i--;
+	}
+
+	return i;
+}
+
+struct Chunk
+{
+	std::string text;
+	bool ascii;
+	// A chunk that isn't well-formed UTF-8 sends the whole file back to be
+	// detected and transcoded whole.
+	bool utf8;
+	bool converted;
+	// The converted text, when converted; text itself goes out otherwise.
+	std::unique_ptr<char[]> out;
+	std::size_t out_length;
+	// Reserved from the memory budget until the chunk is written.
+	std::uint64_t footprint;
+	std::future<void> done;
+};
+
+static std::size_t ReadMore(std::istream &is, std::string &text, std::size_t length)
+{
+	std::size_t old_length = text.length();
+	text.resize(old_length + length);
+	is.read(&text[old_length], length);
+	std::size_t read_length = (std::size_t)is.gcount();
+	text.resize(old_length + read_length);
+	return read_length;
+}
+
+// Returns false, with nothing written, for a file that has to be converted
+// whole: UTF-16, or a charset other than UTF-8. The charset is guessed from
+// the first chunk, and every chunk is checked to be UTF-8 as it converts, so
+// a file that turns out otherwise further in is abandoned part way.
+bool ConvertLargeFile(ConvertContext &context, FileTask const &task)
+{
+	Profile const &profile = context.profile;
+	Stats &stats = context.stats;
+	fs::ifstream ifs(task.input.path, std::ios::binary);
+	if (!ifs.is_open())
+	{
+		std::cerr << "open error: " << task.input.path.u8string() << std::endl;
+		return true;
+	}
+
+	std::string text;
+	bool at_end = ReadMore(ifs, text, kChunkLength) < kChunkLength;
+	std::string extension = task.input.path.extension().u8string();
+
+	Utf16Format utf16_format;
+	if (DetectUtf16(text.data(), text.length(), utf16_format))
+	{
+		return false;
+	}
+
+	if (IsBinary(text.data(), text.length()))
+	{
+		stats.CountExtension(extension, true, task.size);
+		if (CopyOutput(context.durability, task.input, task.output) == 0)
+		{
+			stats.binary_files++;
+			stats.binary_bytes += task.size;
+		}
+
+		return true;
+	}
+
+	if (!IsAscii(text) && DetectCharset(text).compare("UTF-8") != 0)
+	{
+		return false;
+	}
+
+	// Converted text is close to the input in length, so the input size is
+	// the preallocation; Close trims any excess.
+	OutputFile output;
+	int error = output.Open(context.durability.Target(task.output), task.size);
+	if (error != 0)
+	{
+		std::cerr << "open error: " << task.output.path.u8string() << ": " << strerror(error) << std::endl;
+		return true;
+	}
+
+	// Chunks are written in order; a few more than the pool has threads are
+	// kept in flight so that none of them sits idle waiting on the writes.
+	std::deque<std::unique_ptr<Chunk>> pending;
+	std::size_t window = context.chunk_pool.Size() * 2;
+	bool converted = false;
+	bool ascii = true;
+	bool abandoned = false;
+	// Drops every chunk in flight once one turns out not to be UTF-8.
+	auto abandon = [&]() {
+		abandoned = true;
+		while (!pending.empty())
+		{
+			if (pending.front()->done.valid())
+			{
+				pending.front()->done.wait();
+			}
+
+			context.budget.Release(pending.front()->footprint);
+			pending.pop_front();
+		}
+	};
+	// Waits for the oldest chunk, then writes it together with any that are
+	// finished behind it in a single call.
+	auto write_front = [&]() {
+		pending.front()->done.get();
+		std::size_t ready = 1;
+		while (ready < pending.size() && pending[ready]->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			pending[ready]->done.get();
+			ready++;
+		}
+
+		for (std::size_t i = 0; i < ready; i++)
+		{
+			if (!pending[i]->utf8)
+			{
+				abandon();
+				return;
+			}
+		}
+
+		std::vector<OutputBuffer> buffers;
+		for (std::size_t i = 0; i < ready; i++)
+		{
+			Chunk const &chunk = *pending[i];
+			OutputBuffer buffer;
+			buffer.data = chunk.converted ? chunk.out.get() : chunk.text.data();
+			buffer.length = chunk.converted ? chunk.out_length : chunk.text.length();
+			buffers.push_back(buffer);
+		}
+
+		int write_error = output.Write(buffers);
+		if (write_error != 0 && error == 0)
+		{
+			error = write_error;
+		}
+
+		for (std::size_t i = 0; i < ready; i++)
+		{
+			Chunk &chunk = *pending.front();
+			converted = converted || chunk.converted;
+			ascii = ascii && chunk.ascii;
+			context.budget.Release(chunk.footprint);
+			pending.pop_front();
+		}
+	};
+
+	try
+	{
+		while (!text.empty() && !abandoned)
+		{
+			std::size_t cut = at_end ? text.length() : FindCut(text);
+			// A chunk and its conversion. Chunks already in flight are written
+			// out to make room, so this only waits while holding nothing.
+			std::uint64_t footprint = 2 * (std::uint64_t)cut;
+			while (!context.budget.TryAcquire(footprint))
+			{
+				if (pending.empty())
+				{
+					context.budget.Acquire(footprint);
+					break;
+				}
+
+				write_front();
+			}
+
+			if (abandoned)
+			{
+				context.budget.Release(footprint);
+				break;
+			}
+
+			std::unique_ptr<Chunk> chunk(new Chunk());
+			chunk->footprint = footprint;
+			chunk->text = text.substr(0, cut);
+			text.erase(0, cut);
+			Chunk *target = chunk.get();
+			auto job = std::make_shared<std::packaged_task<void()>>([target, &profile]() {
+				target->ascii = IsAscii(target->text);
+				target->utf8 = target->ascii || IsUtf8(target->text.data(), target->text.length());
+				target->converted = target->utf8 && !target->ascii && profile.MayConvert(target->text);
+				if (target->converted)
+				{
+					// Sized for the worst case, so the conversion lands in it
+					// directly; only the pages actually written get touched.
+					std::size_t capacity = profile.MaxConvertedLength(target->text.length());
+					target->out.reset(new char[capacity]);
+					target->out_length = profile.Convert(target->text.data(), target->text.length(), target->out.get(), capacity);
+					target->text.clear();
+					target->text.shrink_to_fit();
+				}
+			});
+
+			chunk->done = job->get_future();
+			pending.push_back(std::move(chunk));
+			context.chunk_pool.Submit([job]() {
+				(*job)();
+			});
+			stats.large_chunks++;
+
+			if (!at_end)
+			{
+				at_end = ReadMore(ifs, text, kChunkLength) < kChunkLength;
+			}
+
+			while (pending.size() >= window)
+			{
+				write_front();
+			}
+		}
+
+		while (!pending.empty())
+		{
+			write_front();
+		}
+	}
+	catch (...)
+	{
+		// The pool still holds pointers to these.
+		for (std::unique_ptr<Chunk> const &chunk : pending)
+		{
+			if (chunk->done.valid())
+			{
+				chunk->done.wait();
+			}
+
+			context.budget.Release(chunk->footprint);
+		}
+
+		throw;
+	}
+
+	int close_error = output.Close();
+	if (abandoned)
+	{
+		std::error_code ec;
+		fs::remove(context.durability.Target(task.output).path, ec);
+		return false;
+	}
+
+	if (error != 0 || close_error != 0)
+	{
+		std::cerr << "write error: " << task.output.path.u8string() << ": " << strerror(error != 0 ? error : close_error) << std::endl;
+	}
+	else
+	{
+		context.durability.Commit(task.output);
+	}
+
+	stats.CountExtension(extension, false, task.size);
+	if (converted)
+	{
+		stats.converted_files++;
+		stats.converted_bytes += task.size;
+	}
+	else if (ascii)
+	{
+		stats.ascii_files++;
+		stats.ascii_bytes += task.size;
+	}
+	else
+	{
+		stats.unchanged_files++;
+		stats.unchanged_bytes += task.size;
+	}
+
+	return true;
+}
+
+// Converts files off the queue until it is closed and drained, routing each
+// by size: small files are gathered into batches that share read buffers,
+// medium files go one at a time, and large files are streamed in chunks.
+// Run by every conversion thread, each with its own backend.
+void ConvertFiles(ConvertContext &context, BoundedQueue<FileTask> &queue, IoBackend &backend)
 {
-	fs::path out_path{ "." };
-	std::string input_str = input_path.u8string();
-	std::string input_dir_str = input_dir.u8string();
-	std::size_t len = input_dir_str.length();
-	std::size_t pos = input_str.find(input_dir_str);
-	if (pos != std::string::npos)
+	Options const &options = context.options;
+	Stats &stats = context.stats;
+	std::vector<FileTask> batch;
+	std::vector<IoFile> batch_reads;
+	std::uint64_t batch_bytes = 0;
+	FileTask task;
+	while (queue.Pop(task))
 	{
-		std::string input_left_str = input_str.substr(pos + len);
-		std::string output_dir_str = output_dir.u8string();
-		std::string out_str = output_dir_str + std::string(1, fs::path::preferred_separator) + input_left_str;
-		out_path = out_str;
+		if (options.large_file_size > 0 && task.size >= options.large_file_size)
+		{
+			stats.large_files++;
+			if (ConvertLargeFile(context, task))
+			{
+				continue;
+			}
+		}
+		else if (task.size >= options.small_file_size)
+		{
+			stats.medium_files++;
+		}
+		else
+		{
+			stats.small_files++;
+			batch_bytes += task.size;
+			batch.push_back(std::move(task));
+			if (batch.size() >= kBatchFiles || batch_bytes >= kBatchBytes)
+			{
+				ConvertBatch(context, backend, batch, batch_reads);
+				batch_bytes = 0;
+			}
+
+			continue;
+		}
+
+		std::vector<FileTask> single(1, std::move(task));
+		std::vector<IoFile> reads;
+		ConvertBatch(context, backend, single, reads);
 	}
 
-	return out_path;
+	ConvertBatch(context, backend, batch, batch_reads);
 }
 
 int main(int argc, char* argv[])
 {
 	try
 	{
-		YAML::Node config = YAML::LoadFile("config.yaml");
-		std::string input = config["cc"]["input_directory"].as<std::string>();
-		std::string output = config["cc"]["output_directory"].as<std::string>();
-		std::vector<std::string> exclude = config["cc"]["exclude_extension"].as<std::vector<std::string>>();
+		Options options;
+		LoadOptions("config.yaml", options);
 
-		fs::path input_dir = fs::u8path(input);
-		fs::path output_dir = fs::u8path(output);
+		fs::path input_dir = fs::u8path(options.input_directory);
+		fs::path output_dir = fs::u8path(options.output_directory);
 
 		if (!CheckPathValid(input_dir, output_dir))
 		{
 			return -1;
 		}
 
-		auto rdi = fs::recursive_directory_iterator(input_dir);
-		for (auto de : rdi)
+		RuleSet rules;
+		rules.Compile(options);
+
+		Profile profile;
+		profile.Load(options.profile, options.engine);
+
+		// Declared ahead of the pools and write-behind threads, whose tasks
+		// use them: on an error those are drained in their destructors, which
+		// run first.
+		Stats stats;
+		Durability durability(options.durability, output_dir);
+		// Excluded files are copied here while other threads get on with
+		// converting.
+		ThreadPool io_pool(options.io_threads);
+
+		std::size_t convert_threads = options.convert_threads;
+		if (convert_threads == 0)
+		{
+			convert_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+
+		// Chunks of large files are converted here, several at a time.
+		ThreadPool chunk_pool(convert_threads);
+		stats.small_file_size = options.small_file_size;
+		stats.large_file_size = options.large_file_size;
+		// The rest follow whatever the first settled on, so a fallback warns once.
+		std::vector<std::unique_ptr<IoBackend>> backends;
+		backends.push_back(NewIoBackend(options.io_backend));
+		for (std::size_t i = 1; i < convert_threads; i++)
 		{
-			fs::path input_path = de.path();
-			fs::path output_path = ConvertOutPath(input_dir, output_dir, input_path);
+			backends.push_back(NewIoBackend(backends[0]->Name()));
+		}
+
+		MemoryBudget budget(options.max_inflight_bytes);
+		// Outputs are written on the I/O threads, behind the conversion.
+		WriteBehind write_behind(backends[0]->Name(), options.io_threads, budget, durability);
+		ConvertContext context{ profile, options, io_pool, chunk_pool, write_behind, budget, durability, stats };
+
+		// The walk runs on its own threads, feeding files to convert to the
+		// conversion threads through a bounded queue.
+		BoundedQueue<FileTask> convert_queue(kQueuedFiles);
+		bool largest_first = options.schedule == "largest_first";
+		std::vector<FileTask> collected;
+		std::mutex collected_mutex;
+		std::exception_ptr walk_error;
+		std::thread walker([&]() {
+			try
+			{
+				stats.failed_directories = WalkTree(input_dir, output_dir, options.walk_threads, [&](WalkEntry &entry) {
+					if (entry.is_directory)
+					{
+						if (!rules.TraverseDirectory(entry.relative_path))
+						{
+							// Excluded directories are left out whole, unvisited.
+							stats.pruned_directories++;
+							return false;
+						}
+
+						return true;
+					}
 
-			if (de.is_regular_file())
-			{			
-				std::string extension = input_path.extension().u8string();
-				std::vector<std::string>::iterator it = std::find_if(exclude.begin(), exclude.end(),
-					[&extension](const std::string &s) {
-					return extension == s;
+					std::uint64_t size = entry.size;
+					FileAction action = rules.MatchFile(entry.relative_path, size);
+					if (action == FileAction::Skip)
+					{
+						stats.skipped_files++;
+						return true;
+					}
+
+					// Written under its converted name straight away, not renamed after.
+					ConvertOutFilename(profile, entry.output);
+
+					if (action == FileAction::Convert && largest_first)
+					{
+						// Held until the walk is over.
+						FileTask task{ entry.input, entry.output, size };
+						ReleaseDirs(task);
+						std::lock_guard<std::mutex> lock(collected_mutex);
+						collected.push_back(std::move(task));
+					}
+					else if (action == FileAction::Convert)
+					{
+						convert_queue.Push(FileTask{ entry.input, entry.output, size });
+					}
+					else
+					{
+						FileTask copy{ entry.input, entry.output, size };
+						ReleaseDirs(copy);
+						io_pool.Submit([copy, &stats, &durability]() {
+							if (CopyOutput(durability, copy.input, copy.output) == 0)
+							{
+								stats.excluded_files++;
+								stats.excluded_bytes += copy.size;
+							}
+						});
+					}
+
+					return true;
 				});
 
-				if (it == exclude.end())
-				{
-					fs::ifstream ifs;
-					ifs.open(de.path());
-
-					std::stringstream ss;
-					ss << ifs.rdbuf();
-					ifs.close();
-
-					std::string out;
-					ConvertSimple2Traditional(std::move(ss.str()), out);
-
-					fs::ofstream ofs;
-					ofs.open(output_path);
-					ofs << out;
-					ofs.flush();
-					ofs.close();
-				}	
-				else
+				// Big files first, while there are small ones left to even out
+				// the finish across threads.
+				std::stable_sort(collected.begin(), collected.end(), [](FileTask const &a, FileTask const &b) {
+					return a.size > b.size;
+				});
+
+				for (FileTask &task : collected)
 				{
-					fs::copy(input_path, output_path);
+					if (!convert_queue.Push(std::move(task)))
+					{
+						break;
+					}
 				}
+			}
+			catch (...)
+			{
+				walk_error = std::current_exception();
+			}
+
+			convert_queue.Close();
+		});
 
-                if (output_path.has_filename())
-                {
-                    std::string convert_output_filename;
-                    ConvertSimple2Traditional(output_path.filename().u8string(), convert_output_filename);
-                    
-                    fs::path output_path_filename = convert_output_filename;
-                    fs::path output_path_temp = output_path;
-                    output_path_temp.replace_filename(output_path_filename);                    
-                    fs::rename(output_path, output_path_temp);                
-                }
+		std::vector<std::exception_ptr> convert_errors(convert_threads);
+		auto convert = [&](std::size_t i) {
+			try
+			{
+				ConvertFiles(context, convert_queue, *backends[i]);
+			}
+			catch (...)
+			{
+				// Unblocks the walk so that it can be joined.
+				convert_errors[i] = std::current_exception();
+				convert_queue.Close();
 			}
-			else if (de.is_directory())
+		};
+
+		std::vector<std::thread> converters;
+		for (std::size_t i = 1; i < convert_threads; i++)
+		{
+			converters.emplace_back(convert, i);
+		}
+
+		convert(0);
+		for (std::thread &converter : converters)
+		{
+			converter.join();
+		}
+
+		walker.join();
+		for (std::exception_ptr const &error : convert_errors)
+		{
+			if (error)
 			{
-				fs::create_directories(output_path);
+				std::rethrow_exception(error);
 			}
 		}
+
+		if (walk_error)
+		{
+			std::rethrow_exception(walk_error);
+		}
+
+		write_behind.Finish();
+		io_pool.Wait();
+		durability.Finish();
+		stats.max_inflight_bytes = budget.Limit();
+		stats.inflight_high_water = budget.HighWater();
+		std::cout << "io backend: " << backends[0]->Name() << ", " << convert_threads << " conversion threads, " << options.schedule << " schedule, durability " << durability.Mode() << ", " << profile.EngineName() << " engine" << std::endl;
+		PrintStats(stats, std::cout);
+		if (stats.failed_directories > 0)
+		{
+			// The output is missing whatever was beneath them.
+			return -1;
+		}
 	}
 	catch (fs::filesystem_error const &fe)
 	{
 		std::cerr << "File Error: " << fe.what() << std::endl;
+		return -1;
+	}
+	catch (opencc::Exception const &oe)
+	{
+		std::cerr << "OpenCC Error: " << oe.what() << std::endl;
+		return -1;
 	}
 	catch (std::exception const &ex)
 	{
 		std::cerr << "Error:" << ex.what() << std::endl;
+		return -1;
 	}
 
 	return 0;
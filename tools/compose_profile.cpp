@@ -0,0 +1,216 @@
+// Composes a profile's conversion chain into one dictionary mapping every
+// key straight to the chain's final output. Where that dictionary can stand
+// in for the whole profile, it is written as <name>.ocd2 with a profile using
+// it as <name>.json, and as <name>.ccd, which cc takes as a profile and maps
+// without parsing. The engine and the composed profiles are then checked
+// against the original on the corpus files given, and said to reproduce it
+// only once that check passes.
+// usage: compose_profile <profile> <name> [corpus file]...
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <opencc/Config.hpp>
+#include <opencc/Converter.hpp>
+#include <opencc/DictEntry.hpp>
+#include <opencc/Exception.hpp>
+#include <opencc/Lexicon.hpp>
+#include <opencc/MarisaDict.hpp>
+#include <opencc/TextDict.hpp>
+#include "../src/ConversionEngine.hpp"
+#include "../src/MappedDict.hpp"
+
+static void WriteDictionary(PrefixDict const &dict, std::string const &file)
+{
+	opencc::LexiconPtr lexicon(new opencc::Lexicon());
+	for (std::size_t i = 0; i < dict.Size(); i++)
+	{
+		lexicon->Add(opencc::DictEntryFactory::New(dict.Key(i), dict.Value(i)));
+	}
+
+	opencc::TextDict text_dict(lexicon);
+	opencc::MarisaDictPtr marisa_dict = opencc::MarisaDict::NewFromDict(text_dict);
+	// MarisaDict's own overload hides the one taking a file name.
+	static_cast<opencc::SerializableDict const &>(*marisa_dict).SerializeToFile(file);
+}
+
+static void WriteProfile(std::string const &name, std::string const &dict_file, std::string const &file)
+{
+	std::ofstream ofs(file, std::ios::binary);
+	ofs << "{\n"
+		<< "  \"name\": \"" << name << "\",\n"
+		<< "  \"segmentation\": {\n"
+		<< "    \"type\": \"mmseg\",\n"
+		<< "    \"dict\": { \"type\": \"ocd2\", \"file\": \"" << dict_file << "\" }\n"
+		<< "  },\n"
+		<< "  \"conversion_chain\": [{\n"
+		<< "    \"dict\": { \"type\": \"ocd2\", \"file\": \"" << dict_file << "\" }\n"
+		<< "  }]\n"
+		<< "}\n";
+	if (!ofs)
+	{
+		throw opencc::FileNotWritable(file);
+	}
+}
+
+// Returns false, after saying so, if the outputs differ or only one side
+// rejects the text.
+static bool Check(char const *label, std::string const &file, bool expected_error, std::string const &expected, bool actual_error, std::string const &actual)
+{
+	if (expected_error != actual_error)
+	{
+		std::cout << file << ": " << label << (actual_error ? " rejects" : " accepts") << " text the profile " << (expected_error ? "rejects" : "accepts") << std::endl;
+		return false;
+	}
+
+	if (!expected_error && actual != expected)
+	{
+		std::cout << file << ": " << label << " output differs" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: " << argv[0] << " <profile> <name> [corpus file]..." << std::endl;
+		return 2;
+	}
+
+	try
+	{
+		opencc::Config config;
+		opencc::ConverterPtr converter = config.NewFromFile(argv[1]);
+		ConversionEngine engine;
+		if (!engine.Load(*converter))
+		{
+			std::cerr << "only maximum matching segmentation can be composed" << std::endl;
+			return 2;
+		}
+
+		std::string name = argv[2];
+		std::vector<std::pair<std::string, std::string>> entries;
+		bool complete = engine.ComposedEntries(entries);
+		opencc::ConverterPtr composed_converter;
+		std::shared_ptr<MappedDict> mapped;
+		ConversionEngine mapped_engine;
+		if (complete)
+		{
+			PrefixDict composed(entries);
+			WriteDictionary(composed, name + ".ocd2");
+			std::cout << name << ".ocd2: " << composed.Size() << " keys written" << std::endl;
+
+			WriteProfile(name, name + ".ocd2", name + ".json");
+			composed_converter = config.NewFromFile(name + ".json");
+			std::cout << name << ".json: written" << std::endl;
+
+			MappedDict::SerializeToFile(composed, name + ".ccd");
+			mapped = MappedDict::NewFromFile(name + ".ccd");
+			mapped_engine.Load(*mapped);
+			std::cout << name << ".ccd: written" << std::endl;
+		}
+		else
+		{
+			// Its segmentation keys alone would make a dictionary that looks
+			// like the profile's but isn't, so nothing is written.
+			std::cout << "nothing written: a conversion has keys of several characters that can match between segmentation keys, so "
+				<< argv[1] << " can't be one dictionary; the engine composes its segmentation keys only" << std::endl;
+		}
+
+		int ret = 0;
+		for (int i = 3; i < argc; i++)
+		{
+			std::ifstream ifs(argv[i], std::ios::binary);
+			std::stringstream buffer;
+			buffer << ifs.rdbuf();
+			std::string text = buffer.str();
+
+			std::string expected;
+			bool expected_error = false;
+			try
+			{
+				expected = converter->Convert(text);
+			}
+			catch (opencc::Exception const &)
+			{
+				expected_error = true;
+			}
+
+			std::string actual;
+			bool actual_error = false;
+			try
+			{
+				engine.Convert(text.data(), text.length(), actual);
+			}
+			catch (opencc::Exception const &)
+			{
+				actual_error = true;
+			}
+
+			if (!Check("engine", argv[i], expected_error, expected, actual_error, actual))
+			{
+				ret = 1;
+			}
+
+			if (composed_converter)
+			{
+				actual_error = false;
+				try
+				{
+					actual = composed_converter->Convert(text);
+				}
+				catch (opencc::Exception const &)
+				{
+					actual_error = true;
+				}
+
+				if (!Check("composed profile", argv[i], expected_error, expected, actual_error, actual))
+				{
+					ret = 1;
+				}
+			}
+
+			if (mapped)
+			{
+				actual_error = false;
+				try
+				{
+					mapped_engine.Convert(text.data(), text.length(), actual);
+				}
+				catch (opencc::Exception const &)
+				{
+					actual_error = true;
+				}
+
+				if (!Check("mapped dictionary", argv[i], expected_error, expected, actual_error, actual))
+				{
+					ret = 1;
+				}
+			}
+		}
+
+		if (argc > 3)
+		{
+			std::cout << argc - 3 << " corpus files: " << (ret == 0 ? "identical" : "DIFFERENT") << std::endl;
+		}
+
+		if (complete && argc == 3)
+		{
+			std::cout << name << ".json and " << name << ".ccd not checked: no corpus files given" << std::endl;
+		}
+		else if (complete && ret == 0)
+		{
+			std::cout << name << ".json and " << name << ".ccd reproduce " << argv[1] << " on the corpus" << std::endl;
+		}
+
+		return ret;
+	}
+	catch (opencc::Exception const &oe)
+	{
+		std::cerr << "OpenCC Error: " << oe.what() << std::endl;
+		return 2;
+	}
+}